@@ -1,8 +1,12 @@
-cc -fPIC -shared -o fin_recipe.dll fin_recipe_source.c
-
-rem cc -fPIC -shared -o fin_recipe.dll test.c
-size fin_recipe.dll
-
-strip --strip-all fin_recipe.dll
-upx -qq fin_recipe.dll
-
+rem Release build: -O3 and LTO. Add -DFIN_RECIPE_32BIT=ON for 32-bit Excel,
+rem -DFIN_RECIPE_MARCH=native for a DLL tuned to this machine only
+rem Excel add-in: -DFIN_RECIPE_XLL=ON -DFIN_RECIPE_XLL_SDK=<Excel XLL SDK>, then load build\fin_recipe.xll
+cmake -S . -B build -G "MinGW Makefiles" -DCMAKE_BUILD_TYPE=Release
+cmake --build build
+copy /Y build\fin_recipe.dll fin_recipe.dll
+
+rem cc -O3 -flto -fPIC -shared -o fin_recipe.dll fin_recipe_source.c
+size fin_recipe.dll
+
+rem No upx: a packed DLL is unpacked on every load and cannot be shared between processes
+strip --strip-unneeded fin_recipe.dll
\ No newline at end of file
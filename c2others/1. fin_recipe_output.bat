@@ -1,5 +1,5 @@
-python c2py.py > fin_recipe_output.txt
-
-cat fin_recipe_output.txt
-
+python c2py.py > fin_recipe_output.txt
+
+cat fin_recipe_output.txt
+
 PAUSE 
\ No newline at end of file
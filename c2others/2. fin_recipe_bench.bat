@@ -0,0 +1,10 @@
+cc -O2 -o bench_fin_recipe.exe bench_fin_recipe.c fin_recipe.dll
+
+bench_fin_recipe > bench_c.csv 2> bench_c_accuracy.csv
+python bench_c2py.py > bench_c2py.csv
+julia bench_c2julia.jl > bench_c2julia.csv
+jconsole bench_c2j.ijs > bench_c2j.csv
+
+cat bench_c.csv bench_c2py.csv bench_c2julia.csv bench_c2j.csv
+
+PAUSE 
\ No newline at end of file
@@ -0,0 +1,265 @@
+# FinRecipe: Julia module over the batch and option chain entry points of fin_recipe
+#
+#   include("FinRecipe.jl"); using .FinRecipe
+#   out = similar(S)
+#   price!(out, :gbs, CP, S, X, T, r, b, v)       # one ccall for the whole column
+#   tprice!(out, :BSAmericanApprox, CP, S, X, T, r, b, v)   # split over Julia threads
+#
+# Unlike c2julia.jl, which broadcasts a scalar ccall over every element,
+# each function here makes one call for a whole column. The inputs are
+# passed by pointer under GC.@preserve, so nothing is copied. Results go
+# into arrays the caller owns: allocate out once and reprice into it.
+#
+# Columns can be any StridedVector with unit stride: a Vector, or a view
+# of a contiguous range of one. CP is Int32, nonzero for calls, and the
+# rest are Float64. A strided view such as view(S, 1:2:n) is rejected;
+# pass copy(view) when you need one.
+#
+# Calls from several Julia threads are safe as long as each one writes a
+# disjoint slice of the output. The library's own pool serves one batch at
+# a time, and a batch that finds it busy runs on the calling thread.
+# tprice! relies on that. Set the library pool to one thread with
+# set_threads(1) when Julia's threads do the splitting.
+#
+# The library is found as "fin_recipe" on the usual search path, or at
+# ENV["FIN_RECIPE_LIB"] when that is set before the module loads.
+
+module FinRecipe
+
+export price!, price_checked!, blackscholes!, cnd!, normdist!, greeks!, implied_vol!,
+    tprice!, GBSGreeks, OptionChain, set_threads, get_threads, set_isa, get_isa
+
+const lib = get(ENV, "FIN_RECIPE_LIB", "fin_recipe")
+
+const Column{T} = StridedVector{T}
+
+# Same layout as gbs_greeks in fin_recipe.h
+struct GBSGreeks
+    price::Float64
+    delta::Float64
+    gamma::Float64
+    vega::Float64
+    theta::Float64
+    rho::Float64
+    carry::Float64
+    vanna::Float64
+    vomma::Float64
+    charm::Float64
+    veta::Float64
+end
+
+# Model numbers of option_chain_price(), FIN_RECIPE_MODEL_* in fin_recipe.h
+const models = Dict(:gbs => Int32(0), :BSAmericanApprox => Int32(1), :BSAmericanApprox2002 => Int32(2))
+
+function checklength(n, cols...)
+    for c in cols
+        length(c) == n || throw(DimensionMismatch("columns of length $(length(c)) and $n"))
+        stride(c, 1) == 1 || throw(ArgumentError("columns must be contiguous, got stride $(stride(c, 1))"))
+    end
+    n <= typemax(Int32) || throw(ArgumentError("at most $(typemax(Int32)) rows per call"))
+    Int32(n)
+end
+
+# Configuration
+set_threads(n::Integer) = Int(@ccall lib.fin_recipe_set_threads(n::Cint)::Cint)
+get_threads() = Int(@ccall lib.fin_recipe_get_threads()::Cint)
+set_isa(isa::Integer) = Int(@ccall lib.fin_recipe_set_isa(isa::Cint)::Cint)
+get_isa() = Int(@ccall lib.fin_recipe_get_isa()::Cint)
+
+function cnd!(out::Column{Float64}, x::Column{Float64})
+    n = checklength(length(out), x)
+    GC.@preserve out x @ccall lib.cnd_batch(n::Cint, pointer(x)::Ptr{Float64}, pointer(out)::Ptr{Float64})::Cvoid
+    out
+end
+
+function normdist!(out::Column{Float64}, x::Column{Float64})
+    n = checklength(length(out), x)
+    GC.@preserve out x @ccall lib.normdist_batch(n::Cint, pointer(x)::Ptr{Float64}, pointer(out)::Ptr{Float64})::Cvoid
+    out
+end
+
+function blackscholes!(out::Column{Float64}, CP::Column{Int32}, S::Column{Float64}, X::Column{Float64},
+                       T::Column{Float64}, r::Column{Float64}, v::Column{Float64})
+    n = checklength(length(out), CP, S, X, T, r, v)
+    GC.@preserve out CP S X T r v @ccall lib.blackscholes_batch(n::Cint,
+        pointer(CP)::Ptr{Int32}, pointer(S)::Ptr{Float64}, pointer(X)::Ptr{Float64},
+        pointer(T)::Ptr{Float64}, pointer(r)::Ptr{Float64}, pointer(v)::Ptr{Float64},
+        pointer(out)::Ptr{Float64})::Cvoid
+    out
+end
+
+"""
+    price!(out, model, CP, S, X, T, r, b, v)
+
+Price every row with `model`, one of `:gbs`, `:BSAmericanApprox` and
+`:BSAmericanApprox2002`, into `out`. Invalid rows fail the library's
+asserts in debug builds; use `price_checked!` for untrusted input.
+"""
+function price!(out::Column{Float64}, model::Symbol, CP::Column{Int32}, S::Column{Float64},
+                X::Column{Float64}, T::Column{Float64}, r::Column{Float64}, b::Column{Float64},
+                v::Column{Float64})
+    n = checklength(length(out), CP, S, X, T, r, b, v)
+    GC.@preserve out CP S X T r b v begin
+        args = (pointer(CP), pointer(S), pointer(X), pointer(T), pointer(r), pointer(b), pointer(v), pointer(out))
+        if model === :gbs
+            @ccall lib.gbs_batch(n::Cint, args[1]::Ptr{Int32}, args[2]::Ptr{Float64}, args[3]::Ptr{Float64},
+                args[4]::Ptr{Float64}, args[5]::Ptr{Float64}, args[6]::Ptr{Float64}, args[7]::Ptr{Float64},
+                args[8]::Ptr{Float64})::Cvoid
+        elseif model === :BSAmericanApprox
+            @ccall lib.BSAmericanApprox_batch(n::Cint, args[1]::Ptr{Int32}, args[2]::Ptr{Float64},
+                args[3]::Ptr{Float64}, args[4]::Ptr{Float64}, args[5]::Ptr{Float64}, args[6]::Ptr{Float64},
+                args[7]::Ptr{Float64}, args[8]::Ptr{Float64})::Cvoid
+        elseif model === :BSAmericanApprox2002
+            @ccall lib.BSAmericanApprox2002_batch(n::Cint, args[1]::Ptr{Int32}, args[2]::Ptr{Float64},
+                args[3]::Ptr{Float64}, args[4]::Ptr{Float64}, args[5]::Ptr{Float64}, args[6]::Ptr{Float64},
+                args[7]::Ptr{Float64}, args[8]::Ptr{Float64})::Cvoid
+        else
+            throw(ArgumentError("unknown model $model"))
+        end
+    end
+    out
+end
+
+"""
+    price_checked!(out, status, model, CP, S, X, T, r, b, v) -> bad
+
+`price!` for untrusted input: invalid rows get NaN and their
+FIN_RECIPE_BAD_* bits in `status` (Int32), and the count of bad rows is
+returned.
+"""
+function price_checked!(out::Column{Float64}, status::Column{Int32}, model::Symbol, CP::Column{Int32},
+                        S::Column{Float64}, X::Column{Float64}, T::Column{Float64}, r::Column{Float64},
+                        b::Column{Float64}, v::Column{Float64})
+    n = checklength(length(out), status, CP, S, X, T, r, b, v)
+    bad = GC.@preserve out status CP S X T r b v begin
+        args = (pointer(CP), pointer(S), pointer(X), pointer(T), pointer(r), pointer(b), pointer(v),
+                pointer(out), pointer(status))
+        if model === :gbs
+            @ccall lib.gbs_batch_checked(n::Cint, args[1]::Ptr{Int32}, args[2]::Ptr{Float64},
+                args[3]::Ptr{Float64}, args[4]::Ptr{Float64}, args[5]::Ptr{Float64}, args[6]::Ptr{Float64},
+                args[7]::Ptr{Float64}, args[8]::Ptr{Float64}, args[9]::Ptr{Int32})::Cint
+        elseif model === :BSAmericanApprox
+            @ccall lib.BSAmericanApprox_batch_checked(n::Cint, args[1]::Ptr{Int32}, args[2]::Ptr{Float64},
+                args[3]::Ptr{Float64}, args[4]::Ptr{Float64}, args[5]::Ptr{Float64}, args[6]::Ptr{Float64},
+                args[7]::Ptr{Float64}, args[8]::Ptr{Float64}, args[9]::Ptr{Int32})::Cint
+        elseif model === :BSAmericanApprox2002
+            @ccall lib.BSAmericanApprox2002_batch_checked(n::Cint, args[1]::Ptr{Int32}, args[2]::Ptr{Float64},
+                args[3]::Ptr{Float64}, args[4]::Ptr{Float64}, args[5]::Ptr{Float64}, args[6]::Ptr{Float64},
+                args[7]::Ptr{Float64}, args[8]::Ptr{Float64}, args[9]::Ptr{Int32})::Cint
+        else
+            throw(ArgumentError("unknown model $model"))
+        end
+    end
+    Int(bad)
+end
+
+function greeks!(out::Column{GBSGreeks}, CP::Column{Int32}, S::Column{Float64}, X::Column{Float64},
+                 T::Column{Float64}, r::Column{Float64}, b::Column{Float64}, v::Column{Float64})
+    n = checklength(length(out), CP, S, X, T, r, b, v)
+    GC.@preserve out CP S X T r b v @ccall lib.gbs_with_greeks_batch(n::Cint,
+        pointer(CP)::Ptr{Int32}, pointer(S)::Ptr{Float64}, pointer(X)::Ptr{Float64},
+        pointer(T)::Ptr{Float64}, pointer(r)::Ptr{Float64}, pointer(b)::Ptr{Float64},
+        pointer(v)::Ptr{Float64}, pointer(out)::Ptr{GBSGreeks})::Cvoid
+    out
+end
+
+"""
+    implied_vol!(out, model, CP, S, X, T, r, b, price; tol = 1e-10, max_iter = 100)
+
+Implied volatilities of `price` under `:gbs` or `:BSAmericanApprox`, NaN
+where the price is out of the model's range.
+"""
+function implied_vol!(out::Column{Float64}, model::Symbol, CP::Column{Int32}, S::Column{Float64},
+                      X::Column{Float64}, T::Column{Float64}, r::Column{Float64}, b::Column{Float64},
+                      price::Column{Float64}; tol::Real = 1e-10, max_iter::Integer = 100)
+    n = checklength(length(out), CP, S, X, T, r, b, price)
+    GC.@preserve out CP S X T r b price begin
+        args = (pointer(CP), pointer(S), pointer(X), pointer(T), pointer(r), pointer(b), pointer(price), pointer(out))
+        if model === :gbs
+            @ccall lib.gbs_implied_vol_batch(n::Cint, args[1]::Ptr{Int32}, args[2]::Ptr{Float64},
+                args[3]::Ptr{Float64}, args[4]::Ptr{Float64}, args[5]::Ptr{Float64}, args[6]::Ptr{Float64},
+                args[7]::Ptr{Float64}, tol::Cdouble, max_iter::Cint, args[8]::Ptr{Float64})::Cvoid
+        elseif model === :BSAmericanApprox
+            @ccall lib.BSAmericanApprox_implied_vol_batch(n::Cint, args[1]::Ptr{Int32}, args[2]::Ptr{Float64},
+                args[3]::Ptr{Float64}, args[4]::Ptr{Float64}, args[5]::Ptr{Float64}, args[6]::Ptr{Float64},
+                args[7]::Ptr{Float64}, tol::Cdouble, max_iter::Cint, args[8]::Ptr{Float64})::Cvoid
+        else
+            throw(ArgumentError("no implied volatility for model $model"))
+        end
+    end
+    out
+end
+
+"""
+    tprice!(out, model, CP, S, X, T, r, b, v; chunks = Threads.nthreads())
+
+`price!` with the rows split into `chunks` contiguous slices, each priced
+on its own Julia task. The slices are views, so nothing is copied, and
+they do not overlap, so the tasks never write the same element.
+"""
+function tprice!(out::Column{Float64}, model::Symbol, cols::Column...; chunks::Integer = Threads.nthreads())
+    n = length(out)
+    checklength(n, cols...)
+    chunks = clamp(chunks, 1, max(n, 1))
+    Threads.@threads for k in 1:chunks
+        rows = (div((k - 1) * n, chunks) + 1):div(k * n, chunks)
+        price!(view(out, rows), model, map(c -> view(c, rows), cols)...)
+    end
+    out
+end
+
+"""
+    OptionChain(n)
+
+An option chain allocated by the library, the columns that
+option_chain_price() reprices in place. Write the inputs into the fields
+and call `price!(chain, model)`. The columns are views into the chain's
+memory and are only valid while the chain is. The chain is freed by the
+garbage collector, or at once by `close`.
+"""
+mutable struct OptionChain
+    handle::Ptr{Cvoid}
+    CP::Vector{Int32}
+    S::Vector{Float64}
+    X::Vector{Float64}
+    T::Vector{Float64}
+    r::Vector{Float64}
+    b::Vector{Float64}
+    v::Vector{Float64}
+    out::Vector{Float64}
+
+    function OptionChain(n::Integer)
+        h = @ccall lib.option_chain_create(n::Cint)::Ptr{Cvoid}
+        h == C_NULL && throw(OutOfMemoryError())
+        col(k) = unsafe_wrap(Array, @ccall(lib.option_chain_column(h::Ptr{Cvoid}, k::Cint)::Ptr{Float64}), n)
+        flags = unsafe_wrap(Array, @ccall(lib.option_chain_flags(h::Ptr{Cvoid})::Ptr{Int32}), n)
+        chain = new(h, flags, col(0), col(1), col(2), col(3), col(4), col(5), col(6))
+        finalizer(close, chain)
+    end
+end
+
+function Base.close(chain::OptionChain)
+    if chain.handle != C_NULL
+        @ccall lib.option_chain_free(chain.handle::Ptr{Cvoid})::Cvoid
+        chain.handle = C_NULL
+    end
+    nothing
+end
+
+Base.length(chain::OptionChain) = length(chain.out)
+
+"""
+    price!(chain, model) -> chain
+
+Reprice the chain in place into `chain.out`.
+"""
+function price!(chain::OptionChain, model::Symbol)
+    chain.handle == C_NULL && throw(ArgumentError("option chain is closed"))
+    m = get(models, model) do
+        throw(ArgumentError("unknown model $model"))
+    end
+    GC.@preserve chain @ccall lib.option_chain_price(chain.handle::Ptr{Cvoid}, m::Cint)::Cint
+    chain
+end
+
+end # module
@@ -0,0 +1,102 @@
+# Benchmark of the ccall binding, same CSV columns as bench_fin_recipe.c
+#
+#   scalar   one ccall per option, what c2julia.jl does
+#   batch    one *_batch ccall on Vectors, passed without copying (kernel time)
+#   marshal  building the Int32/Float64 columns a batch call needs from a
+#            vector of per-option tuples, and collecting the result
+#   ffi_call an empty round trip through ccall, per call
+#
+# julia bench_c2julia.jl [max_n] [scalar_max_n] > bench_c2julia.csv
+
+using Random
+
+const dllfile = "fin_recipe"
+const max_n = length(ARGS) > 0 ? parse(Int, ARGS[1]) : 1_000_000
+const scalar_max_n = length(ARGS) > 1 ? parse(Int, ARGS[2]) : 1_000_000
+const min_ns = 200_000_000
+
+const threads = ccall( (:fin_recipe_set_threads, dllfile), Int32, (Int32,), 0 )
+const isa = ccall( (:fin_recipe_get_isa, dllfile), Int32, () )
+
+# Carry at or below the rate keeps the American put on its valid side
+Random.seed!(20240601)
+uniform(lo, hi, n) = lo .+ (hi - lo) .* rand(n)
+const CP = Int32[i & 1 for i in 0:max_n-1]
+const x = uniform(-5.0, 5.0, max_n)
+const S = uniform(50.0, 150.0, max_n)
+const X = uniform(50.0, 150.0, max_n)
+const T = uniform(0.05, 5.0, max_n)
+const r = uniform(0.0, 0.08, max_n)
+const b = r .- uniform(0.0, 0.05, max_n)
+const v = uniform(0.05, 0.8, max_n)
+const out = similar(S)
+
+cnd(x) = ccall( (:cnd, dllfile), Float64, (Float64,), x )
+blackscholes(CP,S,X,T,r,v) = ccall( (:blackscholes, dllfile), Float64,
+    (Int32, Float64, Float64, Float64, Float64, Float64), CP,S,X,T,r,v )
+gbs(CP,S,X,T,r,b,v) = ccall( (:gbs, dllfile), Float64,
+    (Int32, Float64, Float64, Float64, Float64, Float64, Float64), CP,S,X,T,r,b,v )
+BSAmericanApprox(CP,S,X,T,r,b,v) = ccall( (:BSAmericanApprox, dllfile), Float64,
+    (Int32, Float64, Float64, Float64, Float64, Float64, Float64), CP,S,X,T,r,b,v )
+
+cnd_batch(n, x, out) = ccall( (:cnd_batch, dllfile), Cvoid, (Int32, Ptr{Float64}, Ptr{Float64}), n, x, out )
+blackscholes_batch(n, CP,S,X,T,r,v, out) = ccall( (:blackscholes_batch, dllfile), Cvoid,
+    (Int32, Ptr{Int32}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}),
+    n, CP,S,X,T,r,v, out )
+gbs_batch(n, CP,S,X,T,r,b,v, out) = ccall( (:gbs_batch, dllfile), Cvoid,
+    (Int32, Ptr{Int32}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}),
+    n, CP,S,X,T,r,b,v, out )
+BSAmericanApprox_batch(n, CP,S,X,T,r,b,v, out) = ccall( (:BSAmericanApprox_batch, dllfile), Cvoid,
+    (Int32, Ptr{Int32}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}),
+    n, CP,S,X,T,r,b,v, out )
+
+# fastest of as many repetitions as fit in min_ns, after one warm-up run
+function best(run)
+    run()
+    best_t, reps, start = typemax(UInt64), 0, time_ns()
+    while reps < 3 || time_ns() - start < min_ns
+        t0 = time_ns()
+        run()
+        best_t = min(best_t, time_ns() - t0)
+        reps += 1
+    end
+    best_t, reps
+end
+
+row(kernel, mode, n, (t, reps)) =
+    (println("julia,$kernel,$mode,$n,$threads,$isa,$reps,", round(t / n, digits = 3)); flush(stdout))
+
+function scalar_loop(f, cols, n)
+    acc = 0.0
+    @inbounds for i in 1:n
+        acc += f(map(c -> c[i], cols)...)
+    end
+    acc
+end
+
+const kernels = [
+    ("cnd", cnd, cnd_batch, (x,)),
+    ("blackscholes", blackscholes, blackscholes_batch, (CP, S, X, T, r, v)),
+    ("gbs", gbs, gbs_batch, (CP, S, X, T, r, b, v)),
+    ("BSAmericanApprox", BSAmericanApprox, BSAmericanApprox_batch, (CP, S, X, T, r, b, v)),
+]
+
+println("lang,kernel,mode,n,threads,isa,reps,ns_per_option")
+
+row("noop", "ffi_call", 1000, best(() -> for i in 1:1000 ccall( (:fin_recipe_get_isa, dllfile), Int32, () ) end))
+
+n = 1
+while n <= max_n
+    for (name, f, fb, cols) in kernels
+        views = map(c -> view(c, 1:n), cols)
+        tuples = collect(zip(views...))
+
+        n <= scalar_max_n && row(name, "scalar", n, best(() -> scalar_loop(f, views, n)))
+        row(name, "batch", n, best(() -> fb(n, views..., out)))
+        row(name, "marshal", n, best(() -> begin
+            columns = map(k -> map(t -> t[k], tuples), 1:length(cols))
+            copy(view(out, 1:n))
+        end))
+    end
+    global n *= 10
+end
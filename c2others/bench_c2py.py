@@ -0,0 +1,87 @@
+from ctypes import *
+import random, sys, time
+
+# Benchmark of the ctypes binding, same CSV columns as bench_fin_recipe.c
+#
+#   scalar   one ctypes call per option, what c2py.py does
+#   batch    one *_batch call on arrays already in ctypes form (kernel time)
+#   marshal  turning Python lists into ctypes arrays and the result back
+#   ffi_call an empty round trip through ctypes, per call
+#
+# python bench_c2py.py [max_n] [scalar_max_n] > bench_c2py.csv
+
+max_n = int(sys.argv[1]) if len(sys.argv) > 1 else 1000000
+scalar_max_n = int(sys.argv[2]) if len(sys.argv) > 2 else 100000
+min_s = 0.2
+
+bs = CDLL('fin_recipe.dll')
+for name in ('cnd', 'blackscholes', 'gbs', 'BSAmericanApprox'):
+    getattr(bs, name).restype = c_double
+bs.cnd.argtypes = [c_double]
+bs.blackscholes.argtypes = [c_int] + [c_double] * 5
+bs.gbs.argtypes = bs.BSAmericanApprox.argtypes = [c_int] + [c_double] * 6
+for name in ('cnd_batch', 'blackscholes_batch', 'gbs_batch', 'BSAmericanApprox_batch'):
+    getattr(bs, name).restype = None
+
+threads = bs.fin_recipe_set_threads(0)
+isa = bs.fin_recipe_get_isa()
+
+# Carry at or below the rate keeps the American put on its valid side
+random.seed(20240601)
+chain = {'CP': [i & 1 for i in range(max_n)],
+         'x': [random.uniform(-5.0, 5.0) for i in range(max_n)],
+         'S': [random.uniform(50.0, 150.0) for i in range(max_n)],
+         'X': [random.uniform(50.0, 150.0) for i in range(max_n)],
+         'T': [random.uniform(0.05, 5.0) for i in range(max_n)],
+         'r': [random.uniform(0.0, 0.08) for i in range(max_n)]}
+chain['b'] = [r - random.uniform(0.0, 0.05) for r in chain['r']]
+chain['v'] = [random.uniform(0.05, 0.8) for i in range(max_n)]
+
+columns = {'cnd': ('x',),
+           'blackscholes': ('CP', 'S', 'X', 'T', 'r', 'v'),
+           'gbs': ('CP', 'S', 'X', 'T', 'r', 'b', 'v'),
+           'BSAmericanApprox': ('CP', 'S', 'X', 'T', 'r', 'b', 'v')}
+
+def marshal(kernel, n):
+    args = [(c_int * n)(*chain[k][:n]) if k == 'CP' else (c_double * n)(*chain[k][:n]) for k in columns[kernel]]
+    out = (c_double * n)()
+    return args, out
+
+def best(run, reps_min=3):
+    # fastest of as many repetitions as fit in min_s
+    best_t, reps, start = None, 0, time.perf_counter()
+    while reps < reps_min or time.perf_counter() - start < min_s:
+        t0 = time.perf_counter()
+        run()
+        t = time.perf_counter() - t0
+        best_t = t if best_t is None or t < best_t else best_t
+        reps += 1
+    return best_t, reps
+
+def row(kernel, mode, n, reps, seconds):
+    print("python,%s,%s,%d,%d,%d,%d,%.3f" % (kernel, mode, n, threads, isa, reps, seconds * 1e9 / n))
+    sys.stdout.flush()
+
+print("lang,kernel,mode,n,threads,isa,reps,ns_per_option")
+
+t, reps = best(lambda: [bs.fin_recipe_get_isa() for i in range(1000)])
+row('noop', 'ffi_call', 1000, reps, t)
+
+n = 1
+while n <= max_n:
+    for kernel in columns:
+        f, fb = getattr(bs, kernel), getattr(bs, kernel + '_batch')
+        names = columns[kernel]
+
+        if n <= scalar_max_n:
+            rows = list(zip(*[chain[k][:n] for k in names]))
+            t, reps = best(lambda: [f(*a) for a in rows])
+            row(kernel, 'scalar', n, reps, t)
+
+        args, out = marshal(kernel, n)
+        t, reps = best(lambda: fb(c_int(n), *(args + [out])))
+        row(kernel, 'batch', n, reps, t)
+
+        t, reps = best(lambda: list(marshal(kernel, n)[1]))
+        row(kernel, 'marshal', n, reps, t)
+    n *= 10
@@ -0,0 +1,903 @@
+/*
+ * Benchmark for the fin_recipe kernels.
+ *
+ * Times cnd, blackscholes, gbs and BSAmericanApprox, once through the
+ * scalar entry points in a plain loop and once through the *_batch
+ * entry points, over chain sizes 1, 10, ... up to --max-n. The single
+ * precision cnd_f32 and gbs_f32 have batch entry points only. Before the
+ * timings every kernel and mode is checked against reference values and
+ * its largest errors written to stderr with its error budget, see
+ * check_accuracy(); a breach makes the exit status 3. Every timing
+ * is repeated until --min-ms has passed and the fastest repetition is
+ * reported, in nanoseconds per option, as CSV (default) or JSON on
+ * stdout:
+ *
+ *	lang,kernel,mode,n,threads,isa,reps,ns_per_option
+ *
+ * The same columns are written by bench_c2py.py, bench_c2julia.jl and
+ * bench_c2j.ijs, so results from all drivers can be concatenated and
+ * compared run over run.
+ *
+ * cc -O2 -o bench_fin_recipe bench_fin_recipe.c fin_recipe.dll
+ * bench_fin_recipe [--max-n N] [--min-ms MS] [--threads N] [--isa N] [--json] [--check-only]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "fin_recipe.h"
+
+enum { K_CND, K_BLACKSCHOLES, K_GBS, K_AMERICAN, K_CND_F32, K_GBS_F32, K_COUNT };
+
+static const char *kernel_names[K_COUNT] = {
+	"cnd", "blackscholes", "gbs", "BSAmericanApprox", "cnd_f32", "gbs_f32"
+};
+
+typedef struct chain {
+	int n;
+	int *fCall;
+	double *x, *S, *X, *T, *r, *b, *v, *out;
+	float *xf, *Sf, *Xf, *Tf, *rf, *bf, *vf, *outf;
+} chain;
+
+/* Keeps the compiler from dropping the scalar loops */
+static volatile double sink;
+
+static double now_ns(void)
+{
+#if defined(_WIN32)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER t;
+
+	if(!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart * 1e9 / (double)freq.QuadPart;
+#else
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+#endif
+}
+
+/* Deterministic uniform in [lo, hi) so runs are comparable */
+static double uniform(unsigned long long *state, double lo, double hi)
+{
+	*state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return lo + (hi - lo) * (double)((*state >> 11) & 0xFFFFFFFFFFFFFULL) / 4503599627370496.0;
+}
+
+static int chain_alloc(chain *c, int n)
+{
+	unsigned long long state = 20240601ULL;
+	int i;
+
+	c->n = n;
+	c->fCall = malloc(n * sizeof(int));
+	c->x = malloc(n * sizeof(double));
+	c->S = malloc(n * sizeof(double));
+	c->X = malloc(n * sizeof(double));
+	c->T = malloc(n * sizeof(double));
+	c->r = malloc(n * sizeof(double));
+	c->b = malloc(n * sizeof(double));
+	c->v = malloc(n * sizeof(double));
+	c->out = malloc(n * sizeof(double));
+	c->xf = malloc(8 * (size_t)n * sizeof(float));
+	if(!c->fCall || !c->x || !c->S || !c->X || !c->T || !c->r || !c->b || !c->v || !c->out || !c->xf)
+		return 0;
+	c->Sf = c->xf + n; c->Xf = c->Sf + n; c->Tf = c->Xf + n;
+	c->rf = c->Tf + n; c->bf = c->rf + n; c->vf = c->bf + n; c->outf = c->vf + n;
+
+	/* Carry at or below the rate keeps the American put on its valid side */
+	for(i = 0; i < n; i++) {
+		c->fCall[i] = i & 1;
+		c->x[i] = uniform(&state, -5.0, 5.0);
+		c->S[i] = uniform(&state, 50.0, 150.0);
+		c->X[i] = uniform(&state, 50.0, 150.0);
+		c->T[i] = uniform(&state, 0.05, 5.0);
+		c->r[i] = uniform(&state, 0.0, 0.08);
+		c->b[i] = c->r[i] - uniform(&state, 0.0, 0.05);
+		c->v[i] = uniform(&state, 0.05, 0.8);
+	}
+	/* The float chain holds the same options, rounded once */
+	for(i = 0; i < n; i++) {
+		c->xf[i] = (float)c->x[i];
+		c->Sf[i] = (float)c->S[i]; c->Xf[i] = (float)c->X[i]; c->Tf[i] = (float)c->T[i];
+		c->rf[i] = (float)c->r[i]; c->bf[i] = (float)c->b[i]; c->vf[i] = (float)c->v[i];
+	}
+	return 1;
+}
+
+static void chain_free(chain *c)
+{
+	free(c->fCall); free(c->x); free(c->S); free(c->X); free(c->T);
+	free(c->r); free(c->b); free(c->v); free(c->out); free(c->xf);
+}
+
+/*
+ * Accuracy, checked before any timing. Every pricing entry point is
+ * compared with a reference, and the largest absolute and relative
+ * errors go to stderr as CSV next to the budget of that kernel against
+ * that reference:
+ *
+ *	kernel,mode,reference,isa,threads,n,max_abs_err,max_rel_err,budget_abs,budget_rel,result
+ *
+ * kernel is the function without its _batch suffix, mode the entry
+ * point: scalar, batch or checked (*_batch_checked). Relative errors are
+ * taken against max(|reference|, floor), 0.01 unless the budget says
+ * otherwise, so that options worth next to nothing do not dominate. A
+ * row over budget, or a kernel without one, makes the run exit with
+ * status 3; --check-only stops after the checks. The references are:
+ *
+ *	Haug ...		Haug's worked examples, quoted to 4 decimals and
+ *					priced with the approximate cnd, hence the 1e-4 budget
+ *	fin_recipe_output.txt
+ *					the values c2py.py prints, which must come out unchanged
+ *	erfc			closed forms priced here with erfc() from libm, good
+ *					to the rounding of a double, on the first ACCURACY_N
+ *					options of the chain. The float kernels get the same
+ *					options rounded to float, so only their arithmetic is
+ *					measured
+ *	erfc-tail		cnd_f32 on ACCURACY_TAIL_N points of [-10, -4], with no
+ *					floor: there the whole value is the tail
+ *	difference		delta, gamma and vega of gbs_with_greeks() against
+ *					central differences of the erfc price
+ *	round-trip		the implied volatility solvers on prices of the
+ *					library's own kernels, against the volatilities those
+ *					were priced at, on the options with a vega of at
+ *					least ACCURACY_IV_VEGA: below it the price no longer
+ *					pins the volatility down
+ *	european-lr		american_tree() on calls with b = r, which are never
+ *	european-crr	exercised early, against the erfc price
+ *	stderr			mc_price() of the European payoff against the erfc
+ *					price, in standard errors of the estimate, taken as
+ *					at least ACCURACY_MC_FLOOR for the options whose paths
+ *					all end out of the money
+ *	tree			the approximations against a 1001-step Leisen-Reimer
+ *					tree, see below
+ *	scalar			expiry slices and surfaces of the approximations
+ *					against the scalar function of the same inputs, which
+ *					they must reproduce
+ *	quotes			vol_surface_vol() at the quotes of the surface
+ *	cnd-sensitivity	the approximations against themselves with
+ *					FIN_RECIPE_CND_ERFC. There is no closed form to check
+ *					them with, so this only measures what the approximate
+ *					cnd costs; their own error is the tree row
+ *
+ * The tree rows measure the error of the models rather than of the code,
+ * on the first ACCURACY_TREE_N options of the chain with T <= 1 and
+ * v <= 0.4, the moderate maturities and volatilities the approximations
+ * are meant for. Both underprice the tree there, by up to 3.6% and 0.25,
+ * and the budget is 5% or 0.5. Past that range they get worse: on the
+ * first 1000 options of the whole chain the largest errors are 3.1 for
+ * the 1993 formula and 4.9 for the 2002 one, on long dated, volatile
+ * options, where the 2002 formula does worse than the 1993 one.
+ *
+ * The batch rows repeat for every instruction set the CPU has and for
+ * one thread and the pool; the scalar, tree, implied volatility and Monte
+ * Carlo rows run once. BSAmericanApprox2002, ten times the cost of the
+ * others, is checked on the first ACCURACY_2002_N options only. The
+ * remaining budgets are about twice the errors measured when they were
+ * set: the vectorized cnd, the f32 kernels and any new approximation
+ * have to stay inside them.
+ */
+#define ACCURACY_N			100000
+#define ACCURACY_2002_N		10000
+#define ACCURACY_TAIL_N		601
+#define ACCURACY_TREE_N		1000
+#define ACCURACY_TREE_T		1.0
+#define ACCURACY_TREE_V		0.4
+#define ACCURACY_EUROPEAN_N	200
+#define ACCURACY_IV_N		10000
+#define ACCURACY_IV_VEGA	1.0
+#define ACCURACY_MC_N		64
+#define ACCURACY_MC_PATHS	20000
+#define ACCURACY_MC_FLOOR	1e-4
+#define ACCURACY_SLICES		10
+#define ACCURACY_SLICE_N	1000
+#define ACCURACY_GRIDS		16
+#define ACCURACY_GRID_SPOTS	33
+#define ACCURACY_GRID_VOLS	9
+
+typedef struct published {
+	const char *kernel, *source;
+	int fCall;
+	double S, X, T, r, b, v, value, budget;
+} published;
+
+static const published published_values[] = {
+	/* Worked examples of Haug, The Complete Guide to Option Pricing Formulas */
+	{ "blackscholes", "Haug Black-Scholes", 1, 60.0, 65.0, 0.25, 0.08, 0.08, 0.30, 2.1334, 1e-4 },
+	{ "gbs", "Haug Black-76", 0, 19.0, 19.0, 0.75, 0.10, 0.0, 0.28, 1.7011, 1e-4 },
+	{ "gbs", "Haug Merton", 0, 100.0, 95.0, 0.5, 0.10, 0.05, 0.20, 2.4648, 1e-4 },
+	{ "gbs", "Haug Garman-Kohlhagen", 1, 1.56, 1.60, 0.5, 0.06, -0.02, 0.12, 0.0291, 1e-4 },
+	{ "BSAmericanApprox", "Haug Bjerksund-Stensland", 1, 42.0, 40.0, 0.75, 0.04, -0.04, 0.35, 5.2704, 1e-4 },
+	/* fin_recipe_output.txt, from c2py.py */
+	{ "blackscholes", "fin_recipe_output.txt", 1, 100.0, 100.0, 5.0, 0.1, 0.1, 0.3, 46.03489283282238, 1e-12 },
+	{ "BSAmericanApprox", "fin_recipe_output.txt", 1, 42.0, 40.0, 0.25, 0.04, -0.04, 0.35, 3.711151331459508, 1e-12 },
+	{ "BSAmericanApprox", "fin_recipe_output.txt", 1, 42.0, 40.0, 0.50, 0.04, -0.04, 0.35, 4.618535785705024, 1e-12 },
+	{ "BSAmericanApprox", "fin_recipe_output.txt", 1, 42.0, 40.0, 0.75, 0.04, -0.04, 0.35, 5.270405034258914, 1e-12 },
+	{ "BSAmericanApprox", "fin_recipe_output.txt", 1, 42.0, 40.0, 1.0, 0.04, -0.04, 0.35, 5.786773611401472, 1e-12 },
+	{ "BSAmericanApprox", "fin_recipe_output.txt", 1, 42.0, 40.0, 2.0, 0.04, -0.04, 0.35, 7.1853509989559665, 1e-12 }
+};
+
+/*
+ * Budgets of each kernel against each reference, absolute and relative,
+ * and the reference below which relative errors are taken against floor
+ */
+typedef struct budget {
+	const char *kernel, *reference;
+	double abs, rel, floor;
+} budget;
+
+static const budget budgets[] = {
+	{ "cnd", "erfc", 2e-7, 2e-5, 0.01 },
+	{ "blackscholes", "erfc", 5e-5, 1.5e-3, 0.01 },
+	{ "gbs", "erfc", 5e-5, 1.5e-3, 0.01 },
+	{ "cnd_f32", "erfc", 5e-7, 5e-5, 0.01 },
+	{ "cnd_f32", "erfc-tail", 5e-7, 0.03, 0.0 },
+	{ "gbs_f32", "erfc", 1.5e-4, 2.5e-3, 0.01 },
+	{ "gbs_with_greeks", "erfc", 5e-5, 1.5e-3, 0.01 },
+	{ "gbs_with_greeks.delta", "difference", 2e-7, 2e-5, 0.01 },
+	{ "gbs_with_greeks.gamma", "difference", 5e-8, 2.5e-6, 0.01 },
+	{ "gbs_with_greeks.vega", "difference", 5e-7, 1e-6, 0.01 },
+	{ "expiry_slice_gbs", "erfc", 5e-5, 1.5e-3, 0.01 },
+	{ "expiry_slice_BSAmericanApprox", "scalar", 1e-12, 1e-11, 0.01 },
+	{ "expiry_slice_BSAmericanApprox2002", "scalar", 1e-12, 1e-11, 0.01 },
+	{ "gbs_grid", "erfc", 5e-5, 1.5e-3, 0.01 },
+	{ "gbs_div", "erfc", 5e-5, 1.5e-3, 0.01 },
+	{ "gbs_surface", "erfc", 5e-5, 1.5e-3, 0.01 },
+	{ "BSAmericanApprox_surface", "scalar", 1e-12, 1e-12, 0.01 },
+	{ "BSAmericanApprox2002_surface", "scalar", 1e-12, 1e-12, 0.01 },
+	{ "gbs_implied_vol", "round-trip", 1e-11, 1e-10, 0.01 },
+	{ "BSAmericanApprox_implied_vol", "round-trip", 1e-11, 1e-10, 0.01 },
+	{ "american_tree", "european-lr", 5e-6, 1e-5, 0.01 },
+	{ "american_tree", "european-crr", 0.04, 0.01, 0.01 },
+	{ "mc_price", "stderr", 4.5, 4.5, 1.0 },
+	{ "vol_surface_vol", "quotes", 1e-14, 1e-13, 0.01 },
+	{ "BSAmericanApprox", "cnd-sensitivity", 2.5e-4, 1.5e-3, 0.01 },
+	{ "BSAmericanApprox2002", "cnd-sensitivity", 2.5e-4, 1.5e-3, 0.01 },
+	{ "BSAmericanApprox", "tree", 0.5, 0.05, 0.01 },
+	{ "BSAmericanApprox2002", "tree", 0.5, 0.05, 0.01 }
+};
+
+/* References of the first n options of the chain, see check_accuracy() */
+typedef struct references {
+	int n, n2002, nslice, ngrid;
+	double *cnd, *bs, *gbs, *am, *am2002, *cndf, *gbsf;
+	double *delta, *gamma, *vega, *div;
+	double *surface_gbs, *surface_am, *surface_am2002;
+	double *slice_gbs, *slice_am, *slice_am2002, *grid;
+	double tail_ref[ACCURACY_TAIL_N], quotes[7 * 11];
+	float tail[ACCURACY_TAIL_N], tail_out[ACCURACY_TAIL_N];
+	double dS[ACCURACY_GRID_SPOTS], dv[ACCURACY_GRID_VOLS];
+	dividend_curve *curve;
+	vol_surface *surface;
+	gbs_greeks *greeks;
+	int *status;
+	double *slice_out, *grid_out;
+} references;
+
+/* The surface of the surface rows: a smile that flattens with T */
+static const double surface_T[7] = { 0.05, 0.25, 0.5, 1.0, 2.0, 3.0, 5.0 };
+static const double surface_X[11] = { 50, 60, 70, 80, 90, 100, 110, 120, 130, 140, 150 };
+
+static int accuracy_failures;
+
+static double ref_cnd(double x)
+{
+	return 0.5 * erfc(-x / sqrt(2.0));
+}
+
+static double ref_gbs(int fCall, double S, double X, double T, double r, double b, double v)
+{
+	const double vst = v * sqrt(T);
+	const double d1 = (log(S / X) + (b + v * v / 2.0) * T) / vst;
+	const double d2 = d1 - vst;
+
+	if(fCall)
+		return S * exp((b - r) * T) * ref_cnd(d1) - X * exp(-r * T) * ref_cnd(d2);
+	return X * exp(-r * T) * ref_cnd(-d2) - S * exp((b - r) * T) * ref_cnd(-d1);
+}
+
+/* One row of the accuracy table; out is used when outf is NULL */
+static void report(const char *kernel, const char *mode, const char *reference, int isa,
+	int threads, int n, const double *ref, const double *out, const float *outf,
+	double budget_abs, double budget_rel, double floor)
+{
+	double abs_err = 0.0, rel_err = 0.0, e;
+	int i, ok;
+
+	for(i = 0; i < n; i++) {
+		e = fabs((outf != NULL ? (double)outf[i] : out[i]) - ref[i]);
+		if(!(e <= abs_err))
+			abs_err = e;		/* NaN sticks */
+		e /= fmax(fabs(ref[i]), floor);
+		if(!(e <= rel_err))
+			rel_err = e;
+	}
+	ok = abs_err <= budget_abs && rel_err <= budget_rel;
+	accuracy_failures += !ok;
+	fprintf(stderr, "%s,%s,%s,%d,%d,%d,%.3g,%.3g,%.3g,%.3g,%s\n", kernel, mode, reference,
+		isa, threads, n, abs_err, rel_err, budget_abs, budget_rel, ok ? "ok" : "FAIL");
+}
+
+/* report() against the budget of kernel and reference, a FAIL without one */
+static void report_budget(const char *kernel, const char *mode, const char *reference, int isa,
+	int threads, int n, const double *ref, const double *out, const float *outf)
+{
+	size_t k;
+
+	for(k = 0; k < sizeof budgets / sizeof *budgets; k++)
+		if(!strcmp(budgets[k].kernel, kernel) && !strcmp(budgets[k].reference, reference))
+			break;
+	if(k == sizeof budgets / sizeof *budgets) {
+		report(kernel, mode, reference, isa, threads, n, ref, out, outf, NAN, NAN, 0.01);
+		return;
+	}
+	report(kernel, mode, reference, isa, threads, n, ref, out, outf,
+		budgets[k].abs, budgets[k].rel, budgets[k].floor);
+}
+
+static void check_published(int batch, int isa, int threads)
+{
+	const char *mode = batch ? "batch" : "scalar";
+	const published *p;
+	double out;
+	size_t k;
+
+	for(k = 0; k < sizeof published_values / sizeof *published_values; k++) {
+		p = &published_values[k];
+		if(!strcmp(p->kernel, "blackscholes")) {
+			if(batch)
+				blackscholes_batch(1, &p->fCall, &p->S, &p->X, &p->T, &p->r, &p->v, &out);
+			else
+				out = blackscholes(p->fCall, p->S, p->X, p->T, p->r, p->v);
+		} else if(!strcmp(p->kernel, "gbs")) {
+			if(batch)
+				gbs_batch(1, &p->fCall, &p->S, &p->X, &p->T, &p->r, &p->b, &p->v, &out);
+			else
+				out = gbs(p->fCall, p->S, p->X, p->T, p->r, p->b, p->v);
+		} else {
+			if(batch)
+				BSAmericanApprox_batch(1, &p->fCall, &p->S, &p->X, &p->T, &p->r, &p->b, &p->v, &out);
+			else
+				out = BSAmericanApprox(p->fCall, p->S, p->X, p->T, p->r, p->b, p->v);
+		}
+		report(p->kernel, mode, p->source, isa, threads, 1, &p->value, &out, NULL, p->budget, 1.0, 0.01);
+	}
+}
+
+static void references_free(references *f)
+{
+	free(f->cnd);
+	free(f->greeks);
+	free(f->status);
+	if(f->curve != NULL)
+		dividend_curve_free(f->curve);
+	if(f->surface != NULL)
+		vol_surface_free(f->surface);
+}
+
+static int references_init(references *f, const chain *c)
+{
+	const int n = c->n < ACCURACY_N ? c->n : ACCURACY_N;
+	const int ns = n < ACCURACY_SLICE_N ? n : ACCURACY_SLICE_N;
+	double div_t[20], amount[20], curve_t = 5.0, curve_z = 0.03;
+	double h, v, pv;
+	int i, j, k, m;
+
+	memset(f, 0, sizeof *f);
+	f->n = n;
+	f->n2002 = n < ACCURACY_2002_N ? n : ACCURACY_2002_N;
+	f->nslice = n < ACCURACY_SLICES ? n : ACCURACY_SLICES;
+	f->ngrid = n < ACCURACY_GRIDS ? n : ACCURACY_GRIDS;
+	m = 14 * n + 4 * f->nslice * ns + 2 * f->ngrid * ACCURACY_GRID_SPOTS * ACCURACY_GRID_VOLS;
+	f->cnd = malloc((size_t)m * sizeof(double));
+	f->greeks = malloc((size_t)n * sizeof(gbs_greeks));
+	f->status = malloc((size_t)n * sizeof(int));
+	for(i = 0; i < 20; i++) {
+		div_t[i] = 0.25 * (i + 1);
+		amount[i] = 0.5;
+	}
+	f->curve = dividend_curve_create(1, &curve_t, &curve_z, 20, div_t, amount);
+	for(k = 0; k < 7; k++)
+		for(i = 0; i < 11; i++) {
+			const double u = (surface_X[i] - 100.0) / 50.0;
+
+			f->quotes[k * 11 + i] = 0.2 + (0.1 * u * u - 0.05 * u) / sqrt(1.0 + surface_T[k]);
+		}
+	f->surface = vol_surface_create(7, surface_T, 11, surface_X, f->quotes);
+	if(f->cnd == NULL || f->greeks == NULL || f->status == NULL || f->curve == NULL || f->surface == NULL)
+		return 0;
+
+	f->bs = f->cnd + n; f->gbs = f->bs + n; f->am = f->gbs + n; f->am2002 = f->am + n;
+	f->cndf = f->am2002 + n; f->gbsf = f->cndf + n; f->delta = f->gbsf + n;
+	f->gamma = f->delta + n; f->vega = f->gamma + n; f->div = f->vega + n;
+	f->surface_gbs = f->div + n; f->surface_am = f->surface_gbs + n;
+	f->surface_am2002 = f->surface_am + n;
+	f->slice_gbs = f->surface_am2002 + n;
+	f->slice_am = f->slice_gbs + (size_t)f->nslice * ns;
+	f->slice_am2002 = f->slice_am + (size_t)f->nslice * ns;
+	f->slice_out = f->slice_am2002 + (size_t)f->nslice * ns;
+	f->grid = f->slice_out + (size_t)f->nslice * ns;
+	f->grid_out = f->grid + f->ngrid * ACCURACY_GRID_SPOTS * ACCURACY_GRID_VOLS;
+
+	for(i = 0; i < n; i++) {
+		f->cnd[i] = ref_cnd(c->x[i]);
+		f->bs[i] = ref_gbs(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->r[i], c->v[i]);
+		f->gbs[i] = ref_gbs(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], c->v[i]);
+		f->cndf[i] = ref_cnd(c->xf[i]);
+		f->gbsf[i] = ref_gbs(c->fCall[i], c->Sf[i], c->Xf[i], c->Tf[i], c->rf[i], c->bf[i], c->vf[i]);
+
+		/* Steps scaled to the width of the distribution, gamma peaks in it */
+		h = 1e-4 * c->S[i] * c->v[i] * sqrt(c->T[i]);
+		f->delta[i] = (ref_gbs(c->fCall[i], c->S[i] + h, c->X[i], c->T[i], c->r[i], c->b[i], c->v[i])
+			- ref_gbs(c->fCall[i], c->S[i] - h, c->X[i], c->T[i], c->r[i], c->b[i], c->v[i])) / (2.0 * h);
+		h = 1e-3 * c->S[i] * c->v[i] * sqrt(c->T[i]);
+		f->gamma[i] = (ref_gbs(c->fCall[i], c->S[i] + h, c->X[i], c->T[i], c->r[i], c->b[i], c->v[i])
+			- 2.0 * f->gbs[i]
+			+ ref_gbs(c->fCall[i], c->S[i] - h, c->X[i], c->T[i], c->r[i], c->b[i], c->v[i])) / (h * h);
+		h = 1e-4 * c->v[i];
+		f->vega[i] = (ref_gbs(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], c->v[i] + h)
+			- ref_gbs(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], c->v[i] - h)) / (2.0 * h);
+
+		/* A flat curve: the dividends paid by T, discounted at its rate */
+		for(pv = 0.0, j = 0; j < 20 && div_t[j] <= c->T[i]; j++)
+			pv += amount[j] * exp(-curve_z * div_t[j]);
+		f->div[i] = ref_gbs(c->fCall[i], c->S[i] - pv, c->X[i], c->T[i], curve_z, curve_z, c->v[i]);
+
+		v = vol_surface_vol(f->surface, c->T[i], c->X[i]);
+		f->surface_gbs[i] = ref_gbs(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], v);
+		f->surface_am[i] = BSAmericanApprox(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], v);
+		if(i < f->n2002)
+			f->surface_am2002[i] = BSAmericanApprox2002(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i],
+				c->b[i], v);
+	}
+
+	/* Slice k holds the spot and terms of option k, the strikes of the first ns */
+	for(k = 0; k < f->nslice; k++)
+		for(i = 0; i < ns; i++) {
+			j = k * ns + i;
+			f->slice_gbs[j] = ref_gbs(c->fCall[i], c->S[k], c->X[i], c->T[k], c->r[k], c->b[k], c->v[k]);
+			f->slice_am[j] = BSAmericanApprox(c->fCall[i], c->S[k], c->X[i], c->T[k], c->r[k], c->b[k], c->v[k]);
+			f->slice_am2002[j] = BSAmericanApprox2002(c->fCall[i], c->S[k], c->X[i], c->T[k], c->r[k],
+				c->b[k], c->v[k]);
+		}
+
+	/* ±30% of spot and ±4 points of volatility around the first options */
+	for(i = 0; i < ACCURACY_GRID_SPOTS; i++)
+		f->dS[i] = -0.3 + 0.6 * i / (ACCURACY_GRID_SPOTS - 1);
+	for(j = 0; j < ACCURACY_GRID_VOLS; j++)
+		f->dv[j] = -0.04 + 0.08 * j / (ACCURACY_GRID_VOLS - 1);
+	for(k = 0; k < f->ngrid; k++)
+		for(j = 0; j < ACCURACY_GRID_VOLS; j++)
+			for(i = 0; i < ACCURACY_GRID_SPOTS; i++)
+				f->grid[(k * ACCURACY_GRID_VOLS + j) * ACCURACY_GRID_SPOTS + i] = ref_gbs(c->fCall[k],
+					c->S[k] * (1.0 + f->dS[i]), c->X[k], c->T[k], c->r[k], c->b[k], c->v[k] + f->dv[j]);
+
+	for(i = 0; i < ACCURACY_TAIL_N; i++) {
+		f->tail[i] = (float)(-10.0 + 6.0 * i / (ACCURACY_TAIL_N - 1));
+		f->tail_ref[i] = ref_cnd(f->tail[i]);
+	}
+
+	k = fin_recipe_get_cnd();
+	fin_recipe_set_cnd(FIN_RECIPE_CND_ERFC);
+	for(i = 0; i < n; i++)
+		f->am[i] = BSAmericanApprox(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], c->v[i]);
+	for(i = 0; i < f->n2002; i++)
+		f->am2002[i] = BSAmericanApprox2002(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], c->v[i]);
+	fin_recipe_set_cnd(k);
+	return 1;
+}
+
+/* The rows that go through the batch entry points, for one isa and thread count */
+static void check_batches(chain *c, references *f, int isa, int threads)
+{
+	const int n = f->n, n2002 = f->n2002, ns = n < ACCURACY_SLICE_N ? n : ACCURACY_SLICE_N;
+	const int ngrid = ACCURACY_GRID_SPOTS * ACCURACY_GRID_VOLS;
+	expiry_slice slice;
+	int i, k;
+
+	check_published(1, isa, threads);
+
+	cnd_batch(n, c->x, c->out);
+	report_budget("cnd", "batch", "erfc", isa, threads, n, f->cnd, c->out, NULL);
+	blackscholes_batch(n, c->fCall, c->S, c->X, c->T, c->r, c->v, c->out);
+	report_budget("blackscholes", "batch", "erfc", isa, threads, n, f->bs, c->out, NULL);
+	gbs_batch(n, c->fCall, c->S, c->X, c->T, c->r, c->b, c->v, c->out);
+	report_budget("gbs", "batch", "erfc", isa, threads, n, f->gbs, c->out, NULL);
+	BSAmericanApprox_batch(n, c->fCall, c->S, c->X, c->T, c->r, c->b, c->v, c->out);
+	report_budget("BSAmericanApprox", "batch", "cnd-sensitivity", isa, threads, n, f->am, c->out, NULL);
+	BSAmericanApprox2002_batch(n2002, c->fCall, c->S, c->X, c->T, c->r, c->b, c->v, c->out);
+	report_budget("BSAmericanApprox2002", "batch", "cnd-sensitivity", isa, threads, n2002, f->am2002, c->out, NULL);
+	cnd_batch_f32(n, c->xf, c->outf);
+	report_budget("cnd_f32", "batch", "erfc", isa, threads, n, f->cndf, NULL, c->outf);
+	cnd_batch_f32(ACCURACY_TAIL_N, f->tail, f->tail_out);
+	report_budget("cnd_f32", "batch", "erfc-tail", isa, threads, ACCURACY_TAIL_N, f->tail_ref, NULL, f->tail_out);
+	gbs_batch_f32(n, c->fCall, c->Sf, c->Xf, c->Tf, c->rf, c->bf, c->vf, c->outf);
+	report_budget("gbs_f32", "batch", "erfc", isa, threads, n, f->gbsf, NULL, c->outf);
+
+	/* Every row of the chain is valid, a rejected one shows up as a NaN price */
+	blackscholes_batch_checked(n, c->fCall, c->S, c->X, c->T, c->r, c->v, c->out, f->status);
+	report_budget("blackscholes", "checked", "erfc", isa, threads, n, f->bs, c->out, NULL);
+	gbs_batch_checked(n, c->fCall, c->S, c->X, c->T, c->r, c->b, c->v, c->out, f->status);
+	report_budget("gbs", "checked", "erfc", isa, threads, n, f->gbs, c->out, NULL);
+	BSAmericanApprox_batch_checked(n, c->fCall, c->S, c->X, c->T, c->r, c->b, c->v, c->out, f->status);
+	report_budget("BSAmericanApprox", "checked", "cnd-sensitivity", isa, threads, n, f->am, c->out, NULL);
+	BSAmericanApprox2002_batch_checked(n2002, c->fCall, c->S, c->X, c->T, c->r, c->b, c->v, c->out, f->status);
+	report_budget("BSAmericanApprox2002", "checked", "cnd-sensitivity", isa, threads, n2002, f->am2002,
+		c->out, NULL);
+
+	gbs_with_greeks_batch(n, c->fCall, c->S, c->X, c->T, c->r, c->b, c->v, f->greeks);
+	for(i = 0; i < n; i++)
+		c->out[i] = f->greeks[i].price;
+	report_budget("gbs_with_greeks", "batch", "erfc", isa, threads, n, f->gbs, c->out, NULL);
+	for(i = 0; i < n; i++)
+		c->out[i] = f->greeks[i].delta;
+	report_budget("gbs_with_greeks.delta", "batch", "difference", isa, threads, n, f->delta, c->out, NULL);
+	for(i = 0; i < n; i++)
+		c->out[i] = f->greeks[i].gamma;
+	report_budget("gbs_with_greeks.gamma", "batch", "difference", isa, threads, n, f->gamma, c->out, NULL);
+	for(i = 0; i < n; i++)
+		c->out[i] = f->greeks[i].vega;
+	report_budget("gbs_with_greeks.vega", "batch", "difference", isa, threads, n, f->vega, c->out, NULL);
+
+	for(k = 0; k < f->nslice; k++) {
+		expiry_slice_update(&slice, c->T[k], c->r[k], c->b[k], c->v[k]);
+		expiry_slice_gbs(&slice, ns, c->fCall, c->S[k], c->X, f->slice_out + (size_t)k * ns);
+	}
+	report_budget("expiry_slice_gbs", "batch", "erfc", isa, threads, f->nslice * ns, f->slice_gbs, f->slice_out, NULL);
+	for(k = 0; k < f->nslice; k++) {
+		expiry_slice_update(&slice, c->T[k], c->r[k], c->b[k], c->v[k]);
+		expiry_slice_BSAmericanApprox(&slice, ns, c->fCall, c->S[k], c->X, f->slice_out + (size_t)k * ns);
+	}
+	report_budget("expiry_slice_BSAmericanApprox", "batch", "scalar", isa, threads, f->nslice * ns, f->slice_am,
+		f->slice_out, NULL);
+	for(k = 0; k < f->nslice; k++) {
+		expiry_slice_update(&slice, c->T[k], c->r[k], c->b[k], c->v[k]);
+		expiry_slice_BSAmericanApprox2002(&slice, ns, c->fCall, c->S[k], c->X, f->slice_out + (size_t)k * ns);
+	}
+	report_budget("expiry_slice_BSAmericanApprox2002", "batch", "scalar", isa, threads, f->nslice * ns, f->slice_am2002,
+		f->slice_out, NULL);
+
+	for(k = 0; k < f->ngrid; k++)
+		gbs_grid(c->fCall[k], c->S[k], c->X[k], c->T[k], c->r[k], c->b[k], c->v[k],
+			ACCURACY_GRID_SPOTS, f->dS, ACCURACY_GRID_VOLS, f->dv, f->grid_out + (size_t)k * ngrid);
+	report_budget("gbs_grid", "batch", "erfc", isa, threads, f->ngrid * ngrid, f->grid, f->grid_out, NULL);
+
+	gbs_div_batch(f->curve, n, c->fCall, c->S, c->X, c->T, c->v, c->out);
+	report_budget("gbs_div", "batch", "erfc", isa, threads, n, f->div, c->out, NULL);
+
+	gbs_surface_batch(f->surface, n, c->fCall, c->S, c->X, c->T, c->r, c->b, c->out);
+	report_budget("gbs_surface", "batch", "erfc", isa, threads, n, f->surface_gbs, c->out, NULL);
+	BSAmericanApprox_surface_batch(f->surface, n, c->fCall, c->S, c->X, c->T, c->r, c->b, c->out);
+	report_budget("BSAmericanApprox_surface", "batch", "scalar", isa, threads, n, f->surface_am, c->out, NULL);
+	BSAmericanApprox2002_surface_batch(f->surface, n2002, c->fCall, c->S, c->X, c->T, c->r, c->b, c->out);
+	report_budget("BSAmericanApprox2002_surface", "batch", "scalar", isa, threads, n2002, f->surface_am2002,
+		c->out, NULL);
+}
+
+/* The scalar entry points, once */
+static void check_scalars(chain *c, references *f, int isa)
+{
+	const int n = f->n;
+	gbs_greeks g;
+	double out[7 * 11];
+	int i, k;
+
+	check_published(0, isa, 1);
+
+	for(i = 0; i < n; i++)
+		c->out[i] = cnd(c->x[i]);
+	report_budget("cnd", "scalar", "erfc", isa, 1, n, f->cnd, c->out, NULL);
+	for(i = 0; i < n; i++)
+		c->out[i] = blackscholes(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->v[i]);
+	report_budget("blackscholes", "scalar", "erfc", isa, 1, n, f->bs, c->out, NULL);
+	for(i = 0; i < n; i++)
+		c->out[i] = gbs(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], c->v[i]);
+	report_budget("gbs", "scalar", "erfc", isa, 1, n, f->gbs, c->out, NULL);
+	for(i = 0; i < n; i++)
+		c->out[i] = BSAmericanApprox(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], c->v[i]);
+	report_budget("BSAmericanApprox", "scalar", "cnd-sensitivity", isa, 1, n, f->am, c->out, NULL);
+	for(i = 0; i < f->n2002; i++)
+		c->out[i] = BSAmericanApprox2002(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], c->v[i]);
+	report_budget("BSAmericanApprox2002", "scalar", "cnd-sensitivity", isa, 1, f->n2002, f->am2002,
+		c->out, NULL);
+
+	for(i = 0; i < n; i++)
+		c->out[i] = gbs_with_greeks(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], c->v[i], &g);
+	report_budget("gbs_with_greeks", "scalar", "erfc", isa, 1, n, f->gbs, c->out, NULL);
+	for(i = 0; i < n; i++) {
+		gbs_with_greeks(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], c->v[i], &g);
+		c->out[i] = g.delta;
+	}
+	report_budget("gbs_with_greeks.delta", "scalar", "difference", isa, 1, n, f->delta, c->out, NULL);
+
+	for(i = 0; i < n; i++)
+		c->out[i] = gbs_div(f->curve, c->fCall[i], c->S[i], c->X[i], c->T[i], c->v[i]);
+	report_budget("gbs_div", "scalar", "erfc", isa, 1, n, f->div, c->out, NULL);
+
+	for(k = 0; k < 7; k++)
+		for(i = 0; i < 11; i++)
+			out[k * 11 + i] = vol_surface_vol(f->surface, surface_T[k], surface_X[i]);
+	report_budget("vol_surface_vol", "scalar", "quotes", isa, 1, 7 * 11, f->quotes, out, NULL);
+}
+
+/* Round trips from the library's own prices, on the options whose vega is large enough */
+static void check_implied_vols(const chain *c, const references *f, int isa, int threads)
+{
+	double *col = malloc(9 * (size_t)ACCURACY_IV_N * sizeof(double));
+	int *fCall = malloc(ACCURACY_IV_N * sizeof(int));
+	double *S, *X, *T, *r, *b, *v, *price, *out;
+	int i, n;
+
+	if(col == NULL || fCall == NULL) {
+		fprintf(stderr, "out of memory for the implied volatility checks\n");
+		accuracy_failures++;
+		free(col);
+		free(fCall);
+		return;
+	}
+	S = col; X = S + ACCURACY_IV_N; T = X + ACCURACY_IV_N; r = T + ACCURACY_IV_N;
+	b = r + ACCURACY_IV_N; v = b + ACCURACY_IV_N; price = v + ACCURACY_IV_N; out = price + ACCURACY_IV_N;
+
+	for(i = 0, n = 0; i < f->n && n < ACCURACY_IV_N; i++)
+		if(f->vega[i] >= ACCURACY_IV_VEGA) {
+			fCall[n] = c->fCall[i];
+			S[n] = c->S[i]; X[n] = c->X[i]; T[n] = c->T[i];
+			r[n] = c->r[i]; b[n] = c->b[i]; v[n] = c->v[i];
+			n++;
+		}
+
+	gbs_batch(n, fCall, S, X, T, r, b, v, price);
+	gbs_implied_vol_batch(n, fCall, S, X, T, r, b, price, 1e-12, 100, out);
+	report_budget("gbs_implied_vol", "batch", "round-trip", isa, threads, n, v, out, NULL);
+	for(i = 0; i < n; i++)
+		out[i] = gbs_implied_vol(fCall[i], S[i], X[i], T[i], r[i], b[i], price[i], 1e-12, 100);
+	report_budget("gbs_implied_vol", "scalar", "round-trip", isa, 1, n, v, out, NULL);
+	BSAmericanApprox_batch(n, fCall, S, X, T, r, b, v, price);
+	BSAmericanApprox_implied_vol_batch(n, fCall, S, X, T, r, b, price, 1e-12, 100, out);
+	report_budget("BSAmericanApprox_implied_vol", "batch", "round-trip", isa, threads, n, v, out, NULL);
+
+	free(col);
+	free(fCall);
+}
+
+/*
+ * The implied volatilities, trees and Monte Carlo, once on the pool: they
+ * cost too much to repeat for every instruction set and are the same
+ * arithmetic on each
+ */
+static void check_models(chain *c, references *f, int isa, int threads)
+{
+	const int neu = f->n < ACCURACY_EUROPEAN_N ? f->n : ACCURACY_EUROPEAN_N;
+	const int nmc = f->n < ACCURACY_MC_N ? f->n : ACCURACY_MC_N;
+	int fCall[ACCURACY_TREE_N];
+	double S[ACCURACY_TREE_N], X[ACCURACY_TREE_N], T[ACCURACY_TREE_N], r[ACCURACY_TREE_N];
+	double b[ACCURACY_TREE_N], v[ACCURACY_TREE_N], tree[ACCURACY_TREE_N], ref[ACCURACY_TREE_N];
+	double error[ACCURACY_MC_N];
+	int i, nt;
+
+	/* Calls with b = r: the r column doubles as the carry */
+	for(i = 0; i < neu; i++) {
+		fCall[i] = 1;
+		ref[i] = ref_gbs(1, c->S[i], c->X[i], c->T[i], c->r[i], c->r[i], c->v[i]);
+	}
+	american_tree_batch(neu, fCall, c->S, c->X, c->T, c->r, c->r, c->v, 1001, FIN_RECIPE_TREE_LR, tree);
+	report_budget("american_tree", "batch", "european-lr", isa, threads, neu, ref, tree, NULL);
+	american_tree_batch(neu, fCall, c->S, c->X, c->T, c->r, c->r, c->v, 1001, FIN_RECIPE_TREE_CRR, tree);
+	report_budget("american_tree", "batch", "european-crr", isa, threads, neu, ref, tree, NULL);
+	for(i = 0; i < neu; i++)
+		tree[i] = american_tree(1, c->S[i], c->X[i], c->T[i], c->r[i], c->r[i], c->v[i], 1001,
+			FIN_RECIPE_TREE_LR, NULL);
+	report_budget("american_tree", "scalar", "european-lr", isa, 1, neu, ref, tree, NULL);
+
+	/* The approximations where they are meant to hold, see above */
+	for(i = 0, nt = 0; i < f->n && nt < ACCURACY_TREE_N; i++)
+		if(c->T[i] <= ACCURACY_TREE_T && c->v[i] <= ACCURACY_TREE_V) {
+			fCall[nt] = c->fCall[i];
+			S[nt] = c->S[i]; X[nt] = c->X[i]; T[nt] = c->T[i];
+			r[nt] = c->r[i]; b[nt] = c->b[i]; v[nt] = c->v[i];
+			nt++;
+		}
+	american_tree_batch(nt, fCall, S, X, T, r, b, v, 1001, FIN_RECIPE_TREE_LR, tree);
+	BSAmericanApprox_batch(nt, fCall, S, X, T, r, b, v, ref);
+	report_budget("BSAmericanApprox", "batch", "tree", isa, threads, nt, tree, ref, NULL);
+	BSAmericanApprox2002_batch(nt, fCall, S, X, T, r, b, v, ref);
+	report_budget("BSAmericanApprox2002", "batch", "tree", isa, threads, nt, tree, ref, NULL);
+
+	/* Errors in standard errors, against a reference of 0 */
+	mc_price_batch(nmc, FIN_RECIPE_PAYOFF_EUROPEAN, c->fCall, c->S, c->X, c->T, c->r, c->b, c->v, NULL,
+		ACCURACY_MC_PATHS, 1, 12345u, tree, error);
+	for(i = 0; i < nmc; i++) {
+		tree[i] = (tree[i] - f->gbs[i]) / fmax(error[i], ACCURACY_MC_FLOOR);
+		ref[i] = 0.0;
+	}
+	report_budget("mc_price", "batch", "stderr", isa, threads, nmc, ref, tree, NULL);
+	for(i = 0; i < nmc; i++)
+		tree[i] = (mc_price(FIN_RECIPE_PAYOFF_EUROPEAN, c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i],
+			c->b[i], c->v[i], 0.0, ACCURACY_MC_PATHS, 1, 12345u + i, &error[i]) - f->gbs[i])
+			/ fmax(error[i], ACCURACY_MC_FLOOR);
+	report_budget("mc_price", "scalar", "stderr", isa, 1, nmc, ref, tree, NULL);
+}
+
+static void check_accuracy(chain *c, int threads, int isa)
+{
+	references f;
+	int kisa, t, nthreads[2];
+
+	if(!references_init(&f, c)) {
+		fprintf(stderr, "out of memory for the accuracy checks\n");
+		references_free(&f);
+		accuracy_failures++;
+		return;
+	}
+
+	fprintf(stderr, "kernel,mode,reference,isa,threads,n,max_abs_err,max_rel_err,budget_abs,budget_rel,result\n");
+	check_scalars(c, &f, isa);
+
+	nthreads[0] = 1;
+	nthreads[1] = threads;
+	for(kisa = FIN_RECIPE_ISA_SCALAR; kisa <= isa; kisa++) {
+		if(fin_recipe_set_isa(kisa) != kisa)
+			continue;
+		for(t = 0; t < 2 - (threads == 1); t++) {
+			fin_recipe_set_threads(nthreads[t]);
+			check_batches(c, &f, kisa, nthreads[t]);
+		}
+	}
+	fin_recipe_set_isa(isa);
+
+	check_implied_vols(c, &f, isa, threads);
+	check_models(c, &f, isa, threads);
+	references_free(&f);
+}
+
+static void run_once(const chain *c, int n, int kernel, int batch)
+{
+	double acc = 0.0;
+	int i;
+
+	if(batch) {
+		switch(kernel) {
+			case K_CND:				cnd_batch(n, c->x, c->out); break;
+			case K_BLACKSCHOLES:	blackscholes_batch(n, c->fCall, c->S, c->X, c->T, c->r, c->v, c->out); break;
+			case K_GBS:				gbs_batch(n, c->fCall, c->S, c->X, c->T, c->r, c->b, c->v, c->out); break;
+			case K_AMERICAN:		BSAmericanApprox_batch(n, c->fCall, c->S, c->X, c->T, c->r, c->b, c->v, c->out); break;
+			case K_CND_F32:			cnd_batch_f32(n, c->xf, c->outf); sink = c->outf[n - 1]; return;
+			case K_GBS_F32:
+				gbs_batch_f32(n, c->fCall, c->Sf, c->Xf, c->Tf, c->rf, c->bf, c->vf, c->outf);
+				sink = c->outf[n - 1];
+				return;
+		}
+		sink = c->out[n - 1];
+		return;
+	}
+
+	switch(kernel) {
+		case K_CND:
+			for(i = 0; i < n; i++)
+				acc += cnd(c->x[i]);
+			break;
+		case K_BLACKSCHOLES:
+			for(i = 0; i < n; i++)
+				acc += blackscholes(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->v[i]);
+			break;
+		case K_GBS:
+			for(i = 0; i < n; i++)
+				acc += gbs(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], c->v[i]);
+			break;
+		case K_AMERICAN:
+			for(i = 0; i < n; i++)
+				acc += BSAmericanApprox(c->fCall[i], c->S[i], c->X[i], c->T[i], c->r[i], c->b[i], c->v[i]);
+			break;
+	}
+	sink = acc;
+}
+
+/* Best time per option over as many repetitions as fit in min_ns */
+static double time_kernel(const chain *c, int n, int kernel, int batch, double min_ns, int *reps)
+{
+	double start, t0, t, best = -1.0;
+	int k = 0;
+
+	run_once(c, n, kernel, batch);	/* warm caches and the thread pool */
+	start = now_ns();
+	do {
+		t0 = now_ns();
+		run_once(c, n, kernel, batch);
+		t = now_ns() - t0;
+		if(best < 0.0 || t < best)
+			best = t;
+		k++;
+	} while(now_ns() - start < min_ns || k < 3);
+
+	*reps = k;
+	return best / n;
+}
+
+int main(int argc, char **argv)
+{
+	long max_n = 10000000L;
+	double min_ms = 200.0;
+	int threads = 0, isa = FIN_RECIPE_ISA_AVX512, json = 0, check_only = 0, first = 1;
+	int i, kernel, batch, reps, n;
+	double ns;
+	chain c;
+
+	for(i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--max-n") && i + 1 < argc)
+			max_n = atol(argv[++i]);
+		else if(!strcmp(argv[i], "--min-ms") && i + 1 < argc)
+			min_ms = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--isa") && i + 1 < argc)
+			isa = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--json"))
+			json = 1;
+		else if(!strcmp(argv[i], "--check-only"))
+			check_only = 1;
+		else {
+			fprintf(stderr, "usage: %s [--max-n N] [--min-ms MS] [--threads N] [--isa N] [--json] [--check-only]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	if(max_n < 1 || max_n > 100000000L)
+		max_n = 10000000L;
+
+	threads = fin_recipe_set_threads(threads);
+	isa = fin_recipe_set_isa(isa);
+
+	if(!chain_alloc(&c, (int)max_n)) {
+		fprintf(stderr, "out of memory for %ld options\n", max_n);
+		return 1;
+	}
+
+	check_accuracy(&c, threads, isa);
+	if(check_only) {
+		chain_free(&c);
+		return accuracy_failures ? 3 : 0;
+	}
+
+	if(json)
+		printf("[\n");
+	else
+		printf("lang,kernel,mode,n,threads,isa,reps,ns_per_option\n");
+
+	for(n = 1; n <= max_n; n = n > max_n / 10 ? (int)max_n + 1 : n * 10) {
+		for(kernel = 0; kernel < K_COUNT; kernel++) {
+			for(batch = kernel >= K_CND_F32; batch <= 1; batch++) {
+				ns = time_kernel(&c, n, kernel, batch, min_ms * 1e6, &reps);
+				if(json)
+					printf("%s  {\"lang\": \"c\", \"kernel\": \"%s\", \"mode\": \"%s\", \"n\": %d, "
+						"\"threads\": %d, \"isa\": %d, \"reps\": %d, \"ns_per_option\": %.3f}",
+						first ? "" : ",\n", kernel_names[kernel], batch ? "batch" : "scalar",
+						n, threads, isa, reps, ns);
+				else
+					printf("c,%s,%s,%d,%d,%d,%d,%.3f\n", kernel_names[kernel],
+						batch ? "batch" : "scalar", n, threads, isa, reps, ns);
+				first = 0;
+				fflush(stdout);
+			}
+		}
+	}
+
+	if(json)
+		printf("\n]\n");
+
+	chain_free(&c);
+	return accuracy_failures ? 3 : 0;
+}
@@ -1,23 +1,53 @@
-
-const dllfile = "fin_recipe"
-
-function cnd(x) 
- ccall( 
-     (:cnd, dllfile),    	# name of C function and library
-	 Float64,				# output type
-	 (Float64,),			# tuple of input types
-	 x						# names of Julia variables to pass in
-      )
-end 
-
-print( reshape(cnd.(-0.9:0.1:1), 4,5) ,"\n\n")
-
-
-blackscholes(CP,S,X,T,r,v) =  ccall(  (:blackscholes, dllfile), Float64,	(Int32, Float64,Float64,Float64,Float64,Float64),  CP,S,X,T,r,v	) 
-
-result = map( t -> blackscholes(1,100.0,100.0,t,0.1,0.3) , 1.0 : 10.0)
-
-print(result,"\n --------------end of the program--------------\n")
-
-
-
+
+# One ccall per element, for comparison; FinRecipe.jl wraps the batch entry points
+const dllfile = "fin_recipe"
+
+function cnd(x) 
+ ccall( 
+     (:cnd, dllfile),    	# name of C function and library
+	 Float64,				# output type
+	 (Float64,),			# tuple of input types
+	 x						# names of Julia variables to pass in
+      )
+end 
+
+print( reshape(cnd.(-0.9:0.1:1), 4,5) ,"\n\n")
+
+
+blackscholes(CP,S,X,T,r,v) =  ccall(  (:blackscholes, dllfile), Float64,	(Int32, Float64,Float64,Float64,Float64,Float64),  CP,S,X,T,r,v	) 
+
+result = map( t -> blackscholes(1,100.0,100.0,t,0.1,0.3) , 1.0 : 10.0)
+
+print(result,"\n\n")
+
+# one ccall for the whole column, results written into a preallocated vector
+function gbs_batch(CP::Vector{Int32}, S::Vector{Float64}, X::Vector{Float64}, T::Vector{Float64},
+                   r::Vector{Float64}, b::Vector{Float64}, v::Vector{Float64})
+    out = similar(S)
+    ccall( (:gbs_batch, dllfile), Cvoid,
+           (Int32, Ptr{Int32}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}, Ptr{Float64}),
+           length(S), CP, S, X, T, r, b, v, out )
+    out
+end
+
+T = collect(1.0 : 10.0)
+n = length(T)
+print(gbs_batch(fill(Int32(1), n), fill(100.0, n), fill(100.0, n), T, fill(0.1, n), fill(0.1, n), fill(0.3, n)), "\n")
+
+# option chain owned by the library, columns wrapped zero-copy and repriced in place
+chain = ccall( (:option_chain_create, dllfile), Ptr{Cvoid}, (Int32,), 5 )
+column(k) = unsafe_wrap(Array, ccall( (:option_chain_column, dllfile), Ptr{Float64}, (Ptr{Cvoid}, Int32), chain, k ), 5)
+S, X, T, r, b, v, out = column.(0:6)
+unsafe_wrap(Array, ccall( (:option_chain_flags, dllfile), Ptr{Int32}, (Ptr{Cvoid},), chain ), 5) .= 1
+S .= 42.0; X .= 40.0; T .= [0.25, 0.50, 0.75, 1.0, 2.0]; r .= 0.04; b .= -0.04; v .= 0.35
+ccall( (:option_chain_price, dllfile), Int32, (Ptr{Cvoid}, Int32), chain, 1 )
+print(out, "\n")
+v .= 0.30            # only the vol moved, nothing else is rebuilt
+ccall( (:option_chain_price, dllfile), Int32, (Ptr{Cvoid}, Int32), chain, 1 )
+print(out, "\n")
+ccall( (:option_chain_free, dllfile), Cvoid, (Ptr{Cvoid},), chain )
+
+print("\n --------------end of the program--------------\n")
+
+
+
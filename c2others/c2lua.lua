@@ -1,11 +1,56 @@
-local ffi = require("ffi")
-dllFile = ffi.load("fin_recipe.dll")
-
-ffi.cdef("double cnd(double);")
-
--- Call the function.
-io.write(dllFile.cnd(0.25) .. "\n")
-
-
--- error message while running this code
--- C:/Dev/Lua/ulua/pkg\1_0_beta10/init.lua:204: cannot load module 'fin_recipe.dll': %1 is not a valid Win32 application.
+local ffi = require("ffi")
+
+-- The declarations come from fin_recipe.h, between its FFI markers, so
+-- they cannot drift from the library.
+local header = assert(io.open("fin_recipe.h", "r"))
+ffi.cdef(header:read("*a"):match("FIN_RECIPE_FFI_BEGIN %*%/(.-)%/%* FIN_RECIPE_FFI_END"))
+header:close()
+
+-- "%1 is not a valid Win32 application" means the library and LuaJIT
+-- differ in bitness; 32-bit LuaJIT needs cmake -DFIN_RECIPE_32BIT=ON.
+local ok, fr = pcall(ffi.load, ffi.os == "Windows" and "fin_recipe.dll" or "./fin_recipe" .. (ffi.os == "OSX" and ".dylib" or ".so"))
+if not ok then
+	error(fr .. "\nfin_recipe must be built for the same bitness as LuaJIT (" ..
+		(ffi.abi("32bit") and "32" or "64") .. "-bit here)", 0)
+end
+
+-- Scalar calls, one option at a time
+io.write(fr.cnd(0.25) .. "\n")
+io.write(fr.gbs(1, 42, 40, 0.75, 0.04, -0.04, 0.35) .. "\n")
+
+local g = ffi.new("gbs_greeks")
+fr.gbs_with_greeks(1, 42, 40, 0.75, 0.04, -0.04, 0.35, g)
+io.write(string.format("price %.6f delta %.6f gamma %.6f vega %.6f\n", g.price, g.delta, g.gamma, g.vega))
+
+-- Batch: fill C arrays once and price them in one call instead of
+-- crossing the FFI per option. Arrays are 0-based.
+local n = 100000
+local fCall = ffi.new("int[?]", n)
+local S, X, T = ffi.new("double[?]", n), ffi.new("double[?]", n), ffi.new("double[?]", n)
+local r, b, v = ffi.new("double[?]", n), ffi.new("double[?]", n), ffi.new("double[?]", n)
+local out = ffi.new("double[?]", n)
+local status = ffi.new("int[?]", n)
+for i = 0, n - 1 do
+	fCall[i] = i % 2
+	S[i] = 42
+	X[i] = 30 + 20 * i / n
+	T[i] = 0.1 + 2 * (i % 100) / 100
+	r[i] = 0.04
+	b[i] = -0.04
+	v[i] = 0.35
+end
+
+fr.fin_recipe_set_threads(0)
+fr.gbs_batch(n, fCall, S, X, T, r, b, v, out)
+io.write(string.format("gbs_batch: %.6f ... %.6f\n", out[0], out[n - 1]))
+
+-- The checked variant reports bad rows instead of asserting
+v[1] = -1
+local bad = fr.BSAmericanApprox_batch_checked(n, fCall, S, X, T, r, b, v, out, status)
+io.write(string.format("BSAmericanApprox_batch_checked: %d bad, status[1] = 0x%02x\n", bad, status[1]))
+
+-- One expiry, many strikes: the slice caches the per-expiry terms
+local slice = ffi.new("expiry_slice")
+fr.expiry_slice_update(slice, 0.75, 0.04, -0.04, 0.35)
+fr.expiry_slice_BSAmericanApprox(slice, n, fCall, 42, X, out)
+io.write(string.format("expiry_slice_BSAmericanApprox: %.6f ... %.6f\n", out[0], out[n - 1]))
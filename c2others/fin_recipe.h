@@ -0,0 +1,333 @@
+/*
+ * Public interface of fin_recipe.dll / fin_recipe.so / fin_recipe.dylib.
+ *
+ * Everything between the FIN_RECIPE_FFI_BEGIN and FIN_RECIPE_FFI_END
+ * markers is plain C declarations: no preprocessor lines, only int,
+ * long long, size_t, float, double, pointers and POD structs. A foreign
+ * function interface that parses C can take that block verbatim, e.g.
+ * LuaJIT:
+ *
+ *	local h = io.open("fin_recipe.h"):read("*a")
+ *	ffi.cdef(h:match("FIN_RECIPE_FFI_BEGIN %*%/(.-)%/%* FIN_RECIPE_FFI_END"))
+ *
+ * The declarations are the same for 32- and 64-bit builds; what has to
+ * match is the library itself, a 32-bit host (Excel, LuaJIT) needs a
+ * library built with -DFIN_RECIPE_32BIT=ON.
+ *
+ * Conventions: fCall is nonzero for calls, T is in years, rates, carry and
+ * volatility are annual and decimal (0.05 == 5%). Batch functions take one
+ * column of n values per parameter and write n results to out[], which
+ * the caller allocates; none of them allocates per call, what scratch
+ * they need comes from the calling thread's fin_recipe_ctx. Scalar functions
+ * assert on invalid input, the *_checked batch functions report it per
+ * row instead.
+ */
+#ifndef FIN_RECIPE_H
+#define FIN_RECIPE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* FIN_RECIPE_FFI_BEGIN */
+
+/* Instruction sets for fin_recipe_set_isa() */
+enum {
+	FIN_RECIPE_ISA_SCALAR = 0,
+	FIN_RECIPE_ISA_AVX2 = 1,
+	FIN_RECIPE_ISA_AVX512 = 2
+};
+
+/* cnd() implementations for fin_recipe_set_cnd() */
+enum {
+	FIN_RECIPE_CND_FAST = 0,
+	FIN_RECIPE_CND_HORNER = 1,
+	FIN_RECIPE_CND_HART = 2,
+	FIN_RECIPE_CND_ERFC = 3
+};
+
+/* Per-row status bits of the checked batch functions */
+enum {
+	FIN_RECIPE_OK = 0x00,
+	FIN_RECIPE_BAD_PRICE = 0x01,
+	FIN_RECIPE_BAD_STRIKE = 0x02,
+	FIN_RECIPE_BAD_TIME = 0x04,
+	FIN_RECIPE_BAD_RATE = 0x08,
+	FIN_RECIPE_BAD_CARRY = 0x10,		/* or b > r in an American put */
+	FIN_RECIPE_BAD_VOLATILITY = 0x20,
+	FIN_RECIPE_BAD_RESULT = 0x40
+};
+
+/* Lattices for american_tree() */
+enum {
+	FIN_RECIPE_TREE_CRR = 0,
+	FIN_RECIPE_TREE_LR = 1
+};
+
+/*
+ * Payoffs for mc_price(): the arithmetic average of the monitoring dates
+ * against X, the floating strike lookback (S_T - min or max - S_T, X
+ * unused), and knock-out and knock-in barriers at H, monitored at the
+ * same dates, without rebate.
+ */
+enum {
+	FIN_RECIPE_PAYOFF_EUROPEAN = 0,
+	FIN_RECIPE_PAYOFF_ASIAN = 1,
+	FIN_RECIPE_PAYOFF_LOOKBACK = 2,
+	FIN_RECIPE_PAYOFF_DOWN_OUT = 3,
+	FIN_RECIPE_PAYOFF_UP_OUT = 4,
+	FIN_RECIPE_PAYOFF_DOWN_IN = 5,
+	FIN_RECIPE_PAYOFF_UP_IN = 6
+};
+
+/* Models for option_chain_price(), columns for option_chain_column() */
+enum {
+	FIN_RECIPE_MODEL_GBS = 0,
+	FIN_RECIPE_MODEL_BSAMERICAN = 1,
+	FIN_RECIPE_MODEL_BSAMERICAN2002 = 2
+};
+
+enum {
+	FIN_RECIPE_COL_S = 0,
+	FIN_RECIPE_COL_X = 1,
+	FIN_RECIPE_COL_T = 2,
+	FIN_RECIPE_COL_R = 3,
+	FIN_RECIPE_COL_B = 4,
+	FIN_RECIPE_COL_V = 5,
+	FIN_RECIPE_COL_OUT = 6
+};
+
+typedef struct gbs_greeks {
+	double price;
+	double delta;	/* dV/dS */
+	double gamma;	/* d2V/dS2 */
+	double vega;	/* dV/dv */
+	double theta;	/* -dV/dT */
+	double rho;		/* dV/dr, yield r - b held constant */
+	double carry;	/* dV/db */
+	double vanna;	/* d2V/dSdv */
+	double vomma;	/* d2V/dv2 */
+	double charm;	/* -d2V/dSdT */
+	double veta;	/* -d2V/dvdT */
+} gbs_greeks;
+
+/*
+ * Counters of fin_recipe_get_stats(), in a library built with
+ * -DFIN_RECIPE_STATS. The american* branch counters count evaluations of
+ * the call formulas of BSAmericanApprox() and BSAmericanApprox2002(),
+ * puts after the put-call transformation, from every entry point that
+ * uses them: batches, chains, expiry slices and implied volatilities.
+ * rows[] and cycles[] are per kernel: the options priced
+ * (grid cells for gbs_grid(), blocks of 512 paths for Monte Carlo) and
+ * the time stamp counter ticks spent on them, summed over the threads.
+ */
+enum {
+	FIN_RECIPE_STAT_GBS = 0,
+	FIN_RECIPE_STAT_AMERICAN = 1,
+	FIN_RECIPE_STAT_AMERICAN2002 = 2,
+	FIN_RECIPE_STAT_GREEKS = 3,
+	FIN_RECIPE_STAT_IMPLIED_VOL = 4,
+	FIN_RECIPE_STAT_TREE = 5,
+	FIN_RECIPE_STAT_MC = 6,
+	FIN_RECIPE_STAT_KERNELS = 7
+};
+
+typedef struct fin_recipe_stats {
+	long long american_european;		/* b >= r, priced by gbs() */
+	long long american_exercise;		/* S >= I, worth S - X */
+	long long american_phi;				/* the six phi() terms */
+	long long american2002_european;
+	long long american2002_exercise;
+	long long american2002_full;		/* the phi() and ksi() terms */
+	long long validated;				/* rows through fin_recipe_validate() */
+	long long invalid;					/* of those, rows with a nonzero status */
+	long long rows[FIN_RECIPE_STAT_KERNELS];
+	long long cycles[FIN_RECIPE_STAT_KERNELS];
+} fin_recipe_stats;
+
+/* Opaque, from fin_recipe_ctx_create() or fin_recipe_ctx_thread() */
+typedef struct fin_recipe_ctx fin_recipe_ctx;
+
+/* Opaque, from option_chain_create() */
+typedef struct option_chain option_chain;
+
+/* Opaque, from dividend_curve_create() */
+typedef struct dividend_curve dividend_curve;
+
+/* Opaque, from vol_surface_create() */
+typedef struct vol_surface vol_surface;
+
+/*
+ * Terms of one expiry cached by expiry_slice_update(). The fields are
+ * internal, the struct is public only so a caller can allocate it, e.g.
+ * ffi.new("expiry_slice"), instead of going through expiry_slice_create().
+ */
+typedef struct slice_phi {
+	double gamma;
+	double elambda;		/* exp(lambda) */
+	double drift;		/* (b + (gamma - 0.5) * v^2) * T */
+	double kappa;
+} slice_phi;
+
+typedef struct slice_side {
+	int early;			/* 0 when early exercise is never optimal */
+	double Beta;
+	double I_ratio;		/* trigger price I over the strike */
+	double I1_ratio;	/* 2002 triggers over the strike, for [t1, T] and [0, t1] */
+	double I2_ratio;
+	slice_phi phi[3];	/* gamma = Beta, 1 and 0 */
+} slice_side;
+
+typedef struct expiry_slice {
+	double T, r, b, v;
+	double vst, drift, ebrt, ert;
+	slice_side side[2];	/* [0] puts, as calls with r - b and -b, [1] calls */
+} expiry_slice;
+
+/* Scalar */
+double pow2(double n);
+double normdist(double x);
+double cnd(double x);
+double cnd_fast(double x);
+double cnd_horner(double x);
+double cnd_hart(double x);
+double cnd_erfc(double x);
+double cbnd(double x, double y, double rho);
+double blackscholes(int fCall, double S, double X, double T, double r, double v);
+double gbs(int fCall, double S, double X, double T, double r, double b, double v);
+double gbs_with_greeks(int fCall, double S, double X, double T, double r, double b, double v, gbs_greeks *g);
+double BSAmericanCallApprox(double S, double X, double T, double r, double b, double v);
+double BSAmericanApprox(int fCall, double S, double X, double T, double r, double b, double v);
+double BSAmericanCallApprox2002(double S, double X, double T, double r, double b, double v);
+double BSAmericanApprox2002(int fCall, double S, double X, double T, double r, double b, double v);
+double gbs_implied_vol(int fCall, double S, double X, double T, double r, double b,
+	double price, double tol, int max_iter);
+double BSAmericanApprox_implied_vol(int fCall, double S, double X, double T, double r, double b,
+	double price, double tol, int max_iter);
+
+/* Batch */
+void cnd_batch(int n, const double *x, double *out);
+void normdist_batch(int n, const double *x, double *out);
+void blackscholes_batch(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *v, double *out);
+void gbs_batch(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *v, double *out);
+void BSAmericanApprox_batch(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *v, double *out);
+void BSAmericanApprox2002_batch(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *v, double *out);
+void cnd_batch_f32(int n, const float *x, float *out);
+void gbs_batch_f32(int n, const int *fCall, const float *S, const float *X,
+	const float *T, const float *r, const float *b, const float *v, float *out);
+void gbs_with_greeks_batch(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *v, gbs_greeks *out);
+void gbs_implied_vol_batch(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *price,
+	double tol, int max_iter, double *out);
+void BSAmericanApprox_implied_vol_batch(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *price,
+	double tol, int max_iter, double *out);
+
+/* Checked batch, return the number of invalid rows and fill status[] */
+int fin_recipe_validate(int n, const double *S, const double *X, const double *T,
+	const double *r, const double *b, const double *v, int *status);
+int blackscholes_batch_checked(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *v, double *out, int *status);
+int gbs_batch_checked(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *v, double *out, int *status);
+int BSAmericanApprox_batch_checked(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *v, double *out, int *status);
+int BSAmericanApprox2002_batch_checked(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *v, double *out, int *status);
+
+/* Option chains */
+option_chain *option_chain_create(int n);
+void option_chain_free(option_chain *chain);
+int option_chain_size(const option_chain *chain);
+double *option_chain_column(option_chain *chain, int column);
+int *option_chain_flags(option_chain *chain);
+void option_chain_fill(option_chain *chain, int first, int count, const int *fCall,
+	const double *S, const double *X, const double *T, const double *r, const double *b, const double *v);
+void option_chain_set(option_chain *chain, int column, int i, double value);
+int option_chain_price(option_chain *chain, int model);
+int option_chain_reprice(option_chain *chain, int model, int *changed);
+
+/* Expiry slices */
+expiry_slice *expiry_slice_create(double T, double r, double b, double v);
+void expiry_slice_update(expiry_slice *slice, double T, double r, double b, double v);
+void expiry_slice_free(expiry_slice *slice);
+void expiry_slice_gbs(const expiry_slice *slice, int n, const int *fCall, double S,
+	const double *X, double *out);
+void expiry_slice_BSAmericanApprox(const expiry_slice *slice, int n, const int *fCall, double S,
+	const double *X, double *out);
+void expiry_slice_BSAmericanApprox2002(const expiry_slice *slice, int n, const int *fCall, double S,
+	const double *X, double *out);
+
+/* Scenario grids, out[j * nspot + i] at S * (1 + dS[i]) and v + dv[j] */
+void gbs_grid(int fCall, double S, double X, double T, double r, double b, double v,
+	int nspot, const double *dS, int nvol, const double *dv, double *out);
+
+/* Discrete dividends and rate curves */
+dividend_curve *dividend_curve_create(int ncurve, const double *t, const double *z,
+	int ndiv, const double *div_t, const double *amount);
+void dividend_curve_free(dividend_curve *c);
+double dividend_curve_rate(const dividend_curve *c, double T);
+double dividend_curve_pv(const dividend_curve *c, double T);
+double gbs_div(const dividend_curve *c, int fCall, double S, double X, double T, double v);
+void gbs_div_batch(const dividend_curve *c, int n, const int *fCall, const double *S,
+	const double *X, const double *T, const double *v, double *out);
+
+/* Volatility surfaces, v[k * nstrike + i] at T[k] and X[i] */
+vol_surface *vol_surface_create(int nexpiry, const double *T, int nstrike, const double *X,
+	const double *v);
+void vol_surface_free(vol_surface *s);
+double vol_surface_vol(const vol_surface *s, double T, double X);
+void gbs_surface_batch(const vol_surface *s, int n, const int *fCall, const double *S,
+	const double *X, const double *T, const double *r, const double *b, double *out);
+void BSAmericanApprox_surface_batch(const vol_surface *s, int n, const int *fCall, const double *S,
+	const double *X, const double *T, const double *r, const double *b, double *out);
+void BSAmericanApprox2002_surface_batch(const vol_surface *s, int n, const int *fCall, const double *S,
+	const double *X, const double *T, const double *r, const double *b, double *out);
+
+/* Lattices */
+int american_tree_scratch(int steps);
+double american_tree(int fCall, double S, double X, double T, double r, double b, double v,
+	int steps, int method, double *scratch);
+void american_tree_batch(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *v,
+	int steps, int method, double *out);
+
+/* Monte Carlo, price and standard error */
+double mc_price(int payoff, int fCall, double S, double X, double T, double r, double b, double v,
+	double H, int paths, int steps, unsigned int seed, double *error);
+void mc_price_batch(int n, int payoff, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *v, const double *H,
+	int paths, int steps, unsigned int seed, double *price, double *error);
+
+/* Scratch arenas, one per thread or caller */
+fin_recipe_ctx *fin_recipe_ctx_create(size_t bytes);
+void fin_recipe_ctx_free(fin_recipe_ctx *ctx);
+void *fin_recipe_ctx_alloc(fin_recipe_ctx *ctx, size_t bytes);
+size_t fin_recipe_ctx_mark(const fin_recipe_ctx *ctx);
+void fin_recipe_ctx_release(fin_recipe_ctx *ctx, size_t mark);
+fin_recipe_ctx *fin_recipe_ctx_thread(void);
+
+/* Configuration */
+int fin_recipe_set_isa(int isa);
+int fin_recipe_get_isa(void);
+int fin_recipe_set_cnd(int mode);
+int fin_recipe_get_cnd(void);
+int fin_recipe_set_threads(int n);
+int fin_recipe_get_threads(void);
+int fin_recipe_get_stats(fin_recipe_stats *stats);
+void fin_recipe_reset_stats(void);
+
+/* FIN_RECIPE_FFI_END */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FIN_RECIPE_H */
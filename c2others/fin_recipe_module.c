@@ -0,0 +1,567 @@
+/*
+ * CPython extension over fin_recipe_source.c.
+ *
+ *	python setup.py build_ext --inplace
+ *	>>> import fin_recipe, numpy as np
+ *	>>> fin_recipe.gbs(1, 100.0, np.linspace(80, 120, 1000001), 0.5, 0.05, 0.02, 0.3)
+ *
+ * Every argument is either a number or an object exporting the buffer
+ * protocol (numpy arrays, array.array, memoryview, ...), so numpy is not
+ * needed to build or use the module. Numbers, and buffers holding a
+ * single value, are broadcast against the others; all remaining buffers
+ * must have the same number of elements and the result takes the shape of
+ * the first of them. Without any buffer argument the result is a float.
+ * C-contiguous float64 buffers (int32 for the call/put flags) are read in
+ * place, anything else is converted once.
+ *
+ * The result is written straight into a new numpy array, or a memoryview
+ * over a bytearray without numpy, or into the buffer passed as out=. One
+ * call prices the whole column with the GIL released, on the library's
+ * thread pool (set_threads()).
+ *
+ * Invalid rows price as NaN, as the *_batch_checked entry points do; the
+ * implied volatility functions raise ValueError for them instead.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fin_recipe.h"
+
+#define MAX_COLUMNS 8
+
+/*
+ * Numbers are broadcast through a reused block of this many copies
+ * rather than a full column, which would cost a page-faulting pass over
+ * fresh memory per argument. Each block is still big enough for the
+ * thread pool to split.
+ */
+#define BLOCK 65536
+
+/* One argument as a column of n values, of doubles or of ints */
+typedef struct column {
+	Py_buffer view;
+	int has_view;
+	int is_int;
+	Py_ssize_t n;
+	Py_ssize_t step;	/* 1, or 0 when broadcast from a block */
+	void *data;		/* into view, or tmp */
+	void *tmp;		/* owned conversion or broadcast copy */
+	double d;		/* the value of a number argument */
+	int i;
+} column;
+
+typedef struct call {
+	column cols[MAX_COLUMNS];
+	int ncols;
+	Py_ssize_t n;
+	PyObject *shape;	/* of the result, NULL for numbers only */
+	Py_buffer out_view;
+	int has_out;
+	PyObject *result;
+	double *out;
+	double scalar_out;
+	int *status;
+} call;
+
+static PyObject *numpy_empty;	/* numpy.empty, or Py_None without numpy */
+
+/* Native-order struct codes a buffer may hold, see the struct module */
+static int read_number(char code, const char *p, double *d)
+{
+	switch(code) {
+		case 'd': { double x; memcpy(&x, p, sizeof x); *d = x; return 1; }
+		case 'f': { float x; memcpy(&x, p, sizeof x); *d = x; return 1; }
+		case 'b': { signed char x; memcpy(&x, p, sizeof x); *d = x; return 1; }
+		case 'B': { unsigned char x; memcpy(&x, p, sizeof x); *d = x; return 1; }
+		case '?': { unsigned char x; memcpy(&x, p, sizeof x); *d = x != 0; return 1; }
+		case 'h': { short x; memcpy(&x, p, sizeof x); *d = x; return 1; }
+		case 'H': { unsigned short x; memcpy(&x, p, sizeof x); *d = x; return 1; }
+		case 'i': { int x; memcpy(&x, p, sizeof x); *d = x; return 1; }
+		case 'I': { unsigned int x; memcpy(&x, p, sizeof x); *d = x; return 1; }
+		case 'l': { long x; memcpy(&x, p, sizeof x); *d = (double)x; return 1; }
+		case 'L': { unsigned long x; memcpy(&x, p, sizeof x); *d = (double)x; return 1; }
+		case 'q': { long long x; memcpy(&x, p, sizeof x); *d = (double)x; return 1; }
+		case 'Q': { unsigned long long x; memcpy(&x, p, sizeof x); *d = (double)x; return 1; }
+		case 'n': { Py_ssize_t x; memcpy(&x, p, sizeof x); *d = (double)x; return 1; }
+		case 'N': { size_t x; memcpy(&x, p, sizeof x); *d = (double)x; return 1; }
+		default: return 0;
+	}
+}
+
+static char buffer_code(const Py_buffer *view)
+{
+	const char *f = view->format != NULL ? view->format : "B";
+
+	if(*f == '@' || *f == '=')
+		f++;
+	return f[0] != '\0' && f[1] == '\0' ? f[0] : 0;
+}
+
+/* Turn one argument into a column, 0 with an exception set on failure */
+static int column_open(column *c, PyObject *obj, int is_int, const char *name)
+{
+	memset(c, 0, sizeof *c);
+	c->is_int = is_int;
+
+	if(PyObject_CheckBuffer(obj)) {
+		const char native = is_int ? 'i' : 'd';
+		char code;
+		const char *src;
+		Py_ssize_t k, size;
+
+		if(PyObject_GetBuffer(obj, &c->view, PyBUF_FULL_RO) < 0)
+			return 0;
+		c->has_view = 1;
+		c->n = c->view.itemsize > 0 ? c->view.len / c->view.itemsize : 0;
+		code = buffer_code(&c->view);
+
+		if(code == native && PyBuffer_IsContiguous(&c->view, 'C')) {
+			c->data = c->view.buf;
+			return 1;
+		}
+		if(code == 0 || strchr("dfbB?hHiIlLqQnN", code) == NULL) {
+			PyErr_Format(PyExc_TypeError, "%s: unsupported buffer format '%s'",
+				name, c->view.format != NULL ? c->view.format : "B");
+			return 0;
+		}
+
+		/* Strided or of another type: flatten, then convert */
+		size = c->view.len;
+		c->tmp = PyMem_Malloc(size + c->n * sizeof(double) + 1);
+		if(c->tmp == NULL) {
+			PyErr_NoMemory();
+			return 0;
+		}
+		src = (char *)c->tmp + c->n * sizeof(double);
+		if(PyBuffer_ToContiguous((void *)src, &c->view, size, 'C') < 0)
+			return 0;
+		for(k = 0; k < c->n; k++) {
+			double d = 0.0;
+
+			read_number(code, src + k * c->view.itemsize, &d);
+			if(is_int)
+				((int *)c->tmp)[k] = d != 0.0;
+			else
+				((double *)c->tmp)[k] = d;
+		}
+		c->data = c->tmp;
+		return 1;
+	}
+
+	c->n = 1;
+	if(is_int) {
+		c->i = PyObject_IsTrue(obj);
+		if(c->i < 0)
+			return 0;
+		c->data = &c->i;
+	}
+	else {
+		c->d = PyFloat_AsDouble(obj);
+		if(c->d == -1.0 && PyErr_Occurred())
+			return 0;
+		c->data = &c->d;
+	}
+	return 1;
+}
+
+/* Repeat a single value over a block of the others */
+static int column_broadcast(column *c, Py_ssize_t n)
+{
+	void *tmp;
+	Py_ssize_t k;
+
+	c->step = 1;
+	if(c->n == n)
+		return 1;
+	c->step = 0;
+	if(n > BLOCK)
+		n = BLOCK;
+	tmp = PyMem_Malloc(n * (c->is_int ? sizeof(int) : sizeof(double)));
+	if(tmp == NULL) {
+		PyErr_NoMemory();
+		return 0;
+	}
+	for(k = 0; k < n; k++) {
+		if(c->is_int)
+			((int *)tmp)[k] = *(int *)c->data;
+		else
+			((double *)tmp)[k] = *(double *)c->data;
+	}
+	PyMem_Free(c->tmp);
+	c->tmp = c->data = tmp;
+	return 1;
+}
+
+static void call_close(call *k)
+{
+	int j;
+
+	for(j = 0; j < k->ncols; j++) {
+		if(k->cols[j].has_view)
+			PyBuffer_Release(&k->cols[j].view);
+		PyMem_Free(k->cols[j].tmp);
+	}
+	if(k->has_out)
+		PyBuffer_Release(&k->out_view);
+	Py_XDECREF(k->shape);
+	PyMem_Free(k->status);
+}
+
+static PyObject *shape_of(const Py_buffer *view)
+{
+	PyObject *shape;
+	int j;
+
+	if(view->ndim == 0 || view->shape == NULL)
+		return Py_BuildValue("(n)", view->len / view->itemsize);
+	shape = PyTuple_New(view->ndim);
+	for(j = 0; shape != NULL && j < view->ndim; j++)
+		PyTuple_SET_ITEM(shape, j, PyLong_FromSsize_t(view->shape[j]));
+	return shape;
+}
+
+/* New float64 array of the given shape over fresh memory */
+static PyObject *new_array(PyObject *shape, Py_ssize_t n)
+{
+	PyObject *bytes, *view, *result;
+
+	if(numpy_empty == NULL) {
+		PyObject *numpy = PyImport_ImportModule("numpy");
+
+		if(numpy != NULL) {
+			numpy_empty = PyObject_GetAttrString(numpy, "empty");
+			Py_DECREF(numpy);
+		}
+		if(numpy_empty == NULL) {
+			PyErr_Clear();
+			Py_INCREF(Py_None);
+			numpy_empty = Py_None;
+		}
+	}
+	if(numpy_empty != Py_None)
+		return PyObject_CallFunction(numpy_empty, "(Os)", shape, "float64");
+
+	bytes = PyByteArray_FromStringAndSize(NULL, n * (Py_ssize_t)sizeof(double));
+	if(bytes == NULL)
+		return NULL;
+	view = PyMemoryView_FromObject(bytes);
+	Py_DECREF(bytes);
+	if(view == NULL)
+		return NULL;
+	/* memoryview.cast() refuses a shape with a zero in it, flat is all an empty result needs */
+	if(n == 0)
+		result = PyObject_CallMethod(view, "cast", "s", "d");
+	else
+		result = PyObject_CallMethod(view, "cast", "sO", "d", shape);
+	Py_DECREF(view);
+	return result;
+}
+
+/*
+ * Open the arguments, agree on n, broadcast and set up the output. The
+ * first argument of every function is the call/put flag column.
+ */
+static int call_open(call *k, PyObject **args, int nargs, const char *const *names, PyObject *out)
+{
+	int j;
+
+	memset(k, 0, sizeof *k);
+	k->n = 1;
+	for(j = 0; j < nargs; j++) {
+		column *c = &k->cols[j];
+
+		k->ncols = j + 1;
+		if(!column_open(c, args[j], j == 0 && strcmp(names[0], "CP") == 0, names[j]))
+			return 0;
+		if(c->has_view) {
+			if(k->shape == NULL || (k->n == 1 && c->n != 1)) {
+				Py_XDECREF(k->shape);
+				k->n = c->n;
+				k->shape = shape_of(&c->view);
+				if(k->shape == NULL)
+					return 0;
+			}
+			else if(c->n != k->n && c->n != 1) {
+				PyErr_Format(PyExc_ValueError, "%s: %zd values, expected %zd or 1", names[j], c->n, k->n);
+				return 0;
+			}
+		}
+	}
+	if(k->n > INT_MAX) {
+		PyErr_SetString(PyExc_ValueError, "too many options for one call");
+		return 0;
+	}
+	for(j = 0; j < nargs; j++)
+		if(!column_broadcast(&k->cols[j], k->n))
+			return 0;
+
+	if(out != NULL && out != Py_None) {
+		if(PyObject_GetBuffer(out, &k->out_view, PyBUF_STRIDES | PyBUF_FORMAT | PyBUF_WRITABLE) < 0)
+			return 0;
+		k->has_out = 1;
+		if(buffer_code(&k->out_view) != 'd' || !PyBuffer_IsContiguous(&k->out_view, 'C')
+			|| k->out_view.len != k->n * (Py_ssize_t)sizeof(double)) {
+			PyErr_Format(PyExc_ValueError, "out: expected a writable C-contiguous float64 buffer of %zd values", k->n);
+			return 0;
+		}
+		Py_INCREF(out);
+		k->result = out;
+		k->out = k->out_view.buf;
+	}
+	else if(k->shape != NULL) {
+		k->result = new_array(k->shape, k->n);
+		if(k->result == NULL)
+			return 0;
+		if(PyObject_GetBuffer(k->result, &k->out_view, PyBUF_CONTIG) < 0) {
+			Py_CLEAR(k->result);
+			return 0;
+		}
+		k->has_out = 1;
+		k->out = k->out_view.buf;
+	}
+	else
+		k->out = &k->scalar_out;	/* numbers only, the result becomes a float */
+
+	k->status = PyMem_Malloc((k->n < BLOCK ? k->n : BLOCK) * sizeof(int));
+	if(k->status == NULL) {
+		Py_CLEAR(k->result);
+		PyErr_NoMemory();
+		return 0;
+	}
+	return 1;
+}
+
+static PyObject *call_result(call *k)
+{
+	PyObject *result = k->result != NULL ? k->result : PyFloat_FromDouble(k->out[0]);
+
+	call_close(k);
+	return result;
+}
+
+/* Rows [first, first + BLOCK) of a column */
+#define COL(k, j, first)	((const double *)(k).cols[j].data + (k).cols[j].step * (first))
+#define FLAGS(k, first)		((const int *)(k).cols[0].data + (k).cols[0].step * (first))
+#define BLOCK_SIZE(k, first)	((int)((k).n - (first) < BLOCK ? (k).n - (first) : BLOCK))
+
+static PyObject *py_cnd_like(PyObject *args, PyObject *kwargs, const char *fmt,
+	void (*batch)(int, const double *, double *))
+{
+	static const char *const names[] = { "x", NULL };
+	static char *kwlist[] = { "x", "out", NULL };
+	PyObject *argv[1], *out = NULL;
+	Py_ssize_t first;
+	call k;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, fmt, kwlist, &argv[0], &out))
+		return NULL;
+	if(!call_open(&k, argv, 1, names, out)) {
+		call_close(&k);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	for(first = 0; first < k.n; first += BLOCK)
+		batch(BLOCK_SIZE(k, first), COL(k, 0, first), k.out + first);
+	Py_END_ALLOW_THREADS
+
+	return call_result(&k);
+}
+
+static PyObject *py_cnd(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	return py_cnd_like(args, kwargs, "O|O:cnd", cnd_batch);
+}
+
+static PyObject *py_normdist(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	return py_cnd_like(args, kwargs, "O|O:normdist", normdist_batch);
+}
+
+static PyObject *py_blackscholes(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	static const char *const names[] = { "CP", "S", "X", "T", "r", "v", NULL };
+	static char *kwlist[] = { "CP", "S", "X", "T", "r", "v", "out", NULL };
+	PyObject *argv[6], *out = NULL;
+	Py_ssize_t first;
+	call k;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOO|O:blackscholes", kwlist,
+		&argv[0], &argv[1], &argv[2], &argv[3], &argv[4], &argv[5], &out))
+		return NULL;
+	if(!call_open(&k, argv, 6, names, out)) {
+		call_close(&k);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	for(first = 0; first < k.n; first += BLOCK)
+		blackscholes_batch_checked(BLOCK_SIZE(k, first), FLAGS(k, first),
+			COL(k, 1, first), COL(k, 2, first), COL(k, 3, first),
+			COL(k, 4, first), COL(k, 5, first), k.out + first, k.status);
+	Py_END_ALLOW_THREADS
+
+	return call_result(&k);
+}
+
+static PyObject *py_gbs_like(PyObject *args, PyObject *kwargs, const char *fmt,
+	int (*batch)(int, const int *, const double *, const double *, const double *,
+		const double *, const double *, const double *, double *, int *))
+{
+	static const char *const names[] = { "CP", "S", "X", "T", "r", "b", "v", NULL };
+	static char *kwlist[] = { "CP", "S", "X", "T", "r", "b", "v", "out", NULL };
+	PyObject *argv[7], *out = NULL;
+	Py_ssize_t first;
+	call k;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, fmt, kwlist,
+		&argv[0], &argv[1], &argv[2], &argv[3], &argv[4], &argv[5], &argv[6], &out))
+		return NULL;
+	if(!call_open(&k, argv, 7, names, out)) {
+		call_close(&k);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	for(first = 0; first < k.n; first += BLOCK)
+		batch(BLOCK_SIZE(k, first), FLAGS(k, first),
+			COL(k, 1, first), COL(k, 2, first), COL(k, 3, first),
+			COL(k, 4, first), COL(k, 5, first), COL(k, 6, first), k.out + first, k.status);
+	Py_END_ALLOW_THREADS
+
+	return call_result(&k);
+}
+
+static PyObject *py_gbs(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	return py_gbs_like(args, kwargs, "OOOOOOO|O:gbs", gbs_batch_checked);
+}
+
+static PyObject *py_BSAmericanApprox(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	return py_gbs_like(args, kwargs, "OOOOOOO|O:BSAmericanApprox", BSAmericanApprox_batch_checked);
+}
+
+static PyObject *py_iv_like(PyObject *args, PyObject *kwargs, const char *fmt,
+	void (*batch)(int, const int *, const double *, const double *, const double *,
+		const double *, const double *, const double *, double, int, double *))
+{
+	static const char *const names[] = { "CP", "S", "X", "T", "r", "b", "price", NULL };
+	static char *kwlist[] = { "CP", "S", "X", "T", "r", "b", "price", "tol", "max_iter", "out", NULL };
+	PyObject *argv[7], *out = NULL;
+	double tol = 1e-10;
+	int max_iter = 100, bad = 0;
+	Py_ssize_t first, j;
+	call k;
+
+	if(!PyArg_ParseTupleAndKeywords(args, kwargs, fmt, kwlist,
+		&argv[0], &argv[1], &argv[2], &argv[3], &argv[4], &argv[5], &argv[6],
+		&tol, &max_iter, &out))
+		return NULL;
+	if(!call_open(&k, argv, 7, names, out)) {
+		call_close(&k);
+		return NULL;
+	}
+
+	/* The solvers assert on their inputs, check them with any valid vol */
+	for(j = 0; j < k.n; j++)
+		k.out[j] = 1.0;
+	for(first = 0; first < k.n; first += BLOCK) {
+		bad = fin_recipe_validate(BLOCK_SIZE(k, first),
+			COL(k, 1, first), COL(k, 2, first), COL(k, 3, first),
+			COL(k, 4, first), COL(k, 5, first), k.out + first, k.status);
+		if(bad > 0)
+			break;
+	}
+	if(bad > 0) {
+		for(j = 0; k.status[j] == 0; j++)
+			;
+		PyErr_Format(PyExc_ValueError, "row %zd out of range (status 0x%02x)",
+			first + j, k.status[j]);
+		Py_CLEAR(k.result);
+		call_close(&k);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	for(first = 0; first < k.n; first += BLOCK)
+		batch(BLOCK_SIZE(k, first), FLAGS(k, first),
+			COL(k, 1, first), COL(k, 2, first), COL(k, 3, first),
+			COL(k, 4, first), COL(k, 5, first), COL(k, 6, first), tol, max_iter, k.out + first);
+	Py_END_ALLOW_THREADS
+
+	return call_result(&k);
+}
+
+static PyObject *py_gbs_implied_vol(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	return py_iv_like(args, kwargs, "OOOOOOO|diO:gbs_implied_vol", gbs_implied_vol_batch);
+}
+
+static PyObject *py_BSAmericanApprox_implied_vol(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	return py_iv_like(args, kwargs, "OOOOOOO|diO:BSAmericanApprox_implied_vol", BSAmericanApprox_implied_vol_batch);
+}
+
+#define SETTER(name, fn) \
+	static PyObject *py_##name(PyObject *self, PyObject *arg) \
+	{ \
+		const long value = PyLong_AsLong(arg); \
+		if(value == -1 && PyErr_Occurred()) \
+			return NULL; \
+		return PyLong_FromLong(fn((int)value)); \
+	}
+
+#define GETTER(name, fn) \
+	static PyObject *py_##name(PyObject *self, PyObject *unused) \
+	{ \
+		return PyLong_FromLong(fn()); \
+	}
+
+SETTER(set_threads, fin_recipe_set_threads)
+GETTER(get_threads, fin_recipe_get_threads)
+SETTER(set_isa, fin_recipe_set_isa)
+GETTER(get_isa, fin_recipe_get_isa)
+SETTER(set_cnd, fin_recipe_set_cnd)
+GETTER(get_cnd, fin_recipe_get_cnd)
+
+#define PRICING	METH_VARARGS | METH_KEYWORDS
+
+static PyMethodDef methods[] = {
+	{ "cnd", (PyCFunction)(void (*)(void))py_cnd, PRICING, "cnd(x, out=None): cumulative normal distribution" },
+	{ "normdist", (PyCFunction)(void (*)(void))py_normdist, PRICING, "normdist(x, out=None): standard normal density" },
+	{ "blackscholes", (PyCFunction)(void (*)(void))py_blackscholes, PRICING,
+		"blackscholes(CP, S, X, T, r, v, out=None): European option value" },
+	{ "gbs", (PyCFunction)(void (*)(void))py_gbs, PRICING,
+		"gbs(CP, S, X, T, r, b, v, out=None): generalized Black-Scholes value" },
+	{ "BSAmericanApprox", (PyCFunction)(void (*)(void))py_BSAmericanApprox, PRICING,
+		"BSAmericanApprox(CP, S, X, T, r, b, v, out=None): Bjerksund-Stensland American value" },
+	{ "gbs_implied_vol", (PyCFunction)(void (*)(void))py_gbs_implied_vol, PRICING,
+		"gbs_implied_vol(CP, S, X, T, r, b, price, tol=1e-10, max_iter=100, out=None)" },
+	{ "BSAmericanApprox_implied_vol", (PyCFunction)(void (*)(void))py_BSAmericanApprox_implied_vol, PRICING,
+		"BSAmericanApprox_implied_vol(CP, S, X, T, r, b, price, tol=1e-10, max_iter=100, out=None)" },
+	{ "set_threads", py_set_threads, METH_O, "set_threads(n): size the thread pool, 0 for all cores" },
+	{ "get_threads", py_get_threads, METH_NOARGS, "get_threads(): threads in use" },
+	{ "set_isa", py_set_isa, METH_O, "set_isa(isa): 0 scalar, 1 AVX2, 2 AVX-512" },
+	{ "get_isa", py_get_isa, METH_NOARGS, "get_isa(): instruction set in use" },
+	{ "set_cnd", py_set_cnd, METH_O, "set_cnd(mode): 0 fast, 1 Horner, 2 Hart, 3 erfc" },
+	{ "get_cnd", py_get_cnd, METH_NOARGS, "get_cnd(): cnd implementation in use" },
+	{ NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef module = {
+	PyModuleDef_HEAD_INIT, "fin_recipe",
+	"Option pricing kernels of fin_recipe_source.c over numbers and buffers",
+	-1, methods, NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_fin_recipe(void)
+{
+	return PyModule_Create(&module);
+}
@@ -0,0 +1,328 @@
+/*
+ * kdb+/q adapter over fin_recipe_source.c.
+ *
+ * q loads functions through 2: only if they take and return K objects,
+ * which is why binding the plain double functions crashes. The functions
+ * here take K arguments and price through the batch kernels:
+ *
+ *	fr:`fin_recipe_q 2:
+ *	gbs:fr(`q_gbs;7)
+ *	update px:gbs[CP;S;X;T;r;b;v] from chain
+ *
+ * Every argument is an atom or a vector. Float vectors are read in
+ * place, boolean, byte, short, int, long and real ones are converted, and
+ * atoms are broadcast against the vectors, which must all have the same
+ * length. The result is a float vector, or a float atom when every
+ * argument is an atom. Invalid rows and integer nulls give 0n.
+ *
+ * The functions only allocate the result and some scratch, so they are
+ * safe to run from peach threads; the batch thread pool serves one call
+ * at a time and runs the others on their own thread.
+ *
+ * Needs k.h from kx.com (https://github.com/KxSystems/kdb/blob/master/c/c/k.h);
+ * build with -DFIN_RECIPE_Q=ON, see CMakeLists.txt.
+ */
+
+#include "fin_recipe.h"
+
+#define KXVER 3
+#include "k.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ARGS 7
+
+/* Atoms are broadcast through a reused block of this many copies */
+#define BLOCK 65536
+
+#define IV_TOL		1e-10
+#define IV_MAX_ITER	100
+
+typedef struct qcol {
+	void *data;
+	void *tmp;		/* converted vector or broadcast block, owned */
+	J n;			/* -1 for atoms */
+	J step;			/* 1, or 0 when broadcast */
+	double d;
+	int i;
+} qcol;
+
+typedef struct qcall {
+	qcol cols[MAX_ARGS];
+	int ncols;
+	J n;
+	K result;
+	double *out;
+	int *status;
+} qcall;
+
+/* Element k of a vector, or the atom for k < 0; integer nulls read as NaN */
+static int q_value(K x, J k, double *d)
+{
+	switch(x->t) {
+		case -KB: case -KG:	*d = x->g; return 1;
+		case -KH:	*d = x->h == nh ? NAN : x->h; return 1;
+		case -KI:	*d = x->i == ni ? NAN : x->i; return 1;
+		case -KJ:	*d = x->j == nj ? NAN : (double)x->j; return 1;
+		case -KE:	*d = x->e; return 1;
+		case -KF:	*d = x->f; return 1;
+		case KB: case KG:	*d = kG(x)[k]; return 1;
+		case KH:	*d = kH(x)[k] == nh ? NAN : kH(x)[k]; return 1;
+		case KI:	*d = kI(x)[k] == ni ? NAN : kI(x)[k]; return 1;
+		case KJ:	*d = kJ(x)[k] == nj ? NAN : (double)kJ(x)[k]; return 1;
+		case KE:	*d = kE(x)[k]; return 1;
+		case KF:	*d = kF(x)[k]; return 1;
+		default:	return 0;
+	}
+}
+
+/* Returns NULL, or the q error to signal */
+static const char *qcol_open(qcol *c, K x, int is_int)
+{
+	J k;
+
+	memset(c, 0, sizeof *c);
+	if(x->t < 0) {
+		c->n = -1;
+		if(!q_value(x, -1, &c->d))
+			return "type";
+		c->i = c->d != 0.0;
+		c->data = is_int ? (void *)&c->i : (void *)&c->d;
+		return NULL;
+	}
+
+	c->n = x->n;
+	c->step = 1;
+	if(!is_int && x->t == KF) {
+		c->data = kF(x);
+		return NULL;
+	}
+	if(is_int && x->t == KI) {
+		c->data = kI(x);
+		return NULL;
+	}
+
+	c->tmp = malloc((size_t)(c->n > 0 ? c->n : 1) * (is_int ? sizeof(int) : sizeof(double)));
+	if(c->tmp == NULL)
+		return "wsfull";
+	for(k = 0; k < c->n; k++) {
+		double d;
+
+		if(!q_value(x, k, &d))
+			return "type";
+		if(is_int)
+			((int *)c->tmp)[k] = d != 0.0;
+		else
+			((double *)c->tmp)[k] = d;
+	}
+	c->data = c->tmp;
+	return NULL;
+}
+
+static const char *qcol_broadcast(qcol *c, J n)
+{
+	J k;
+
+	if(c->n >= 0)
+		return NULL;
+	if(n > BLOCK)
+		n = BLOCK;
+	c->tmp = malloc((size_t)n * sizeof(double));
+	if(c->tmp == NULL)
+		return "wsfull";
+	for(k = 0; k < n; k++) {
+		if(c->data == &c->i)
+			((int *)c->tmp)[k] = c->i;
+		else
+			((double *)c->tmp)[k] = c->d;
+	}
+	c->data = c->tmp;
+	return NULL;
+}
+
+static void qcall_close(qcall *q)
+{
+	int j;
+
+	for(j = 0; j < q->ncols; j++)
+		free(q->cols[j].tmp);
+	free(q->status);
+}
+
+/* The first argument is the call/put flag column unless int_first is 0 */
+static K qcall_open(qcall *q, K *args, int nargs, int int_first)
+{
+	const char *err = NULL;
+	int j;
+
+	memset(q, 0, sizeof *q);
+	q->n = -1;
+	for(j = 0; j < nargs && err == NULL; j++) {
+		q->ncols = j + 1;
+		err = qcol_open(&q->cols[j], args[j], int_first && j == 0);
+		if(err == NULL && q->cols[j].n >= 0) {
+			if(q->n < 0)
+				q->n = q->cols[j].n;
+			else if(q->cols[j].n != q->n)
+				err = "length";
+		}
+	}
+	if(err == NULL && q->n > 0x7fffffff)
+		err = "limit";
+	for(j = 0; j < nargs && err == NULL; j++)
+		err = qcol_broadcast(&q->cols[j], q->n < 0 ? 1 : q->n);
+	if(err == NULL) {
+		q->status = malloc((size_t)(q->n > BLOCK ? BLOCK : q->n > 0 ? q->n : 1) * sizeof(int));
+		if(q->status == NULL)
+			err = "wsfull";
+	}
+	if(err != NULL) {
+		qcall_close(q);
+		return krr((S)err);
+	}
+
+	q->result = q->n < 0 ? kf(0.0) : ktn(KF, q->n);
+	q->out = q->n < 0 ? &q->result->f : kF(q->result);
+	if(q->n < 0)
+		q->n = 1;
+	return NULL;
+}
+
+static K qcall_result(qcall *q)
+{
+	qcall_close(q);
+	return q->result;
+}
+
+/* Rows [first, first + BLOCK) of a column */
+#define COL(q, j, first)	((const double *)(q).cols[j].data + (q).cols[j].step * (first))
+#define FLAGS(q, first)		((const int *)(q).cols[0].data + (q).cols[0].step * (first))
+#define BLOCK_SIZE(q, first)	((int)((q).n - (first) < BLOCK ? (q).n - (first) : BLOCK))
+
+K q_cnd(K x)
+{
+	qcall q;
+	J first;
+	K e = qcall_open(&q, &x, 1, 0);
+
+	if(e != NULL)
+		return e;
+	for(first = 0; first < q.n; first += BLOCK)
+		cnd_batch(BLOCK_SIZE(q, first), COL(q, 0, first), q.out + first);
+	return qcall_result(&q);
+}
+
+K q_blackscholes(K CP, K S, K X, K T, K r, K v)
+{
+	K args[6];
+	qcall q;
+	J first;
+	K e;
+
+	args[0] = CP; args[1] = S; args[2] = X; args[3] = T; args[4] = r; args[5] = v;
+	if((e = qcall_open(&q, args, 6, 1)) != NULL)
+		return e;
+	for(first = 0; first < q.n; first += BLOCK)
+		blackscholes_batch_checked(BLOCK_SIZE(q, first), FLAGS(q, first),
+			COL(q, 1, first), COL(q, 2, first), COL(q, 3, first),
+			COL(q, 4, first), COL(q, 5, first), q.out + first, q.status);
+	return qcall_result(&q);
+}
+
+static K q_price(K *args, int (*batch)(int, const int *, const double *, const double *,
+	const double *, const double *, const double *, const double *, double *, int *))
+{
+	qcall q;
+	J first;
+	K e;
+
+	if((e = qcall_open(&q, args, 7, 1)) != NULL)
+		return e;
+	for(first = 0; first < q.n; first += BLOCK)
+		batch(BLOCK_SIZE(q, first), FLAGS(q, first),
+			COL(q, 1, first), COL(q, 2, first), COL(q, 3, first),
+			COL(q, 4, first), COL(q, 5, first), COL(q, 6, first), q.out + first, q.status);
+	return qcall_result(&q);
+}
+
+K q_gbs(K CP, K S, K X, K T, K r, K b, K v)
+{
+	K args[7];
+
+	args[0] = CP; args[1] = S; args[2] = X; args[3] = T; args[4] = r; args[5] = b; args[6] = v;
+	return q_price(args, gbs_batch_checked);
+}
+
+K q_BSAmericanApprox(K CP, K S, K X, K T, K r, K b, K v)
+{
+	K args[7];
+
+	args[0] = CP; args[1] = S; args[2] = X; args[3] = T; args[4] = r; args[5] = b; args[6] = v;
+	return q_price(args, BSAmericanApprox_batch_checked);
+}
+
+/*
+ * The solvers assert on their inputs, so rows are validated first (with
+ * a placeholder vol) and only the runs of valid rows are solved.
+ */
+static K q_implied_vol(K *args, void (*batch)(int, const int *, const double *, const double *,
+	const double *, const double *, const double *, const double *, double, int, double *))
+{
+	qcall q;
+	J first;
+	int i, j, m;
+	K e;
+
+	if((e = qcall_open(&q, args, 7, 1)) != NULL)
+		return e;
+	for(first = 0; first < q.n; first += BLOCK) {
+		m = BLOCK_SIZE(q, first);
+		for(i = 0; i < m; i++)
+			q.out[first + i] = 1.0;
+		fin_recipe_validate(m, COL(q, 1, first), COL(q, 2, first), COL(q, 3, first),
+			COL(q, 4, first), COL(q, 5, first), q.out + first, q.status);
+
+		for(i = 0; i < m; i = j) {
+			if(q.status[i] != 0) {
+				q.out[first + i] = NAN;
+				j = i + 1;
+				continue;
+			}
+			for(j = i + 1; j < m && q.status[j] == 0; j++)
+				;
+			batch(j - i, FLAGS(q, first + i),
+				COL(q, 1, first + i), COL(q, 2, first + i), COL(q, 3, first + i),
+				COL(q, 4, first + i), COL(q, 5, first + i), COL(q, 6, first + i),
+				IV_TOL, IV_MAX_ITER, q.out + first + i);
+		}
+	}
+	return qcall_result(&q);
+}
+
+K q_gbs_implied_vol(K CP, K S, K X, K T, K r, K b, K price)
+{
+	K args[7];
+
+	args[0] = CP; args[1] = S; args[2] = X; args[3] = T; args[4] = r; args[5] = b; args[6] = price;
+	return q_implied_vol(args, gbs_implied_vol_batch);
+}
+
+K q_BSAmericanApprox_implied_vol(K CP, K S, K X, K T, K r, K b, K price)
+{
+	K args[7];
+
+	args[0] = CP; args[1] = S; args[2] = X; args[3] = T; args[4] = r; args[5] = b; args[6] = price;
+	return q_implied_vol(args, BSAmericanApprox_implied_vol_batch);
+}
+
+/* Size the batch thread pool, 0 for all cores; returns the threads in use */
+K q_set_threads(K n)
+{
+	double d;
+
+	if(n->t >= 0 || !q_value(n, -1, &d))
+		return krr("type");
+	return ki(fin_recipe_set_threads((int)d));
+}
@@ -0,0 +1,468 @@
+/*
+ * SIMD kernel template for fin_recipe_source.c.
+ *
+ * This file is not a header in the usual sense. fin_recipe_source.c
+ * includes it once per instruction set, after defining the vector type
+ * and the handful of v_* primitives below, inside a region compiled for
+ * that instruction set. Every function defined here gets its name
+ * suffixed through FR_ISA(), so the AVX2 and AVX-512 copies can live side
+ * by side and be selected at load time.
+ *
+ * Required definitions:
+ *	FR_V			vector of doubles
+ *	FR_VM			lane mask as returned by v_lt()/v_flags()
+ *	FR_VW			number of lanes
+ *	FR_ISA(name)	name with the instruction set suffix
+ *	v_set1(x) v_loadu(p) v_storeu(p, a)
+ *	v_add v_sub v_mul v_div v_min v_max v_sqrt v_abs
+ *	v_fma(a, b, c)		a * b + c
+ *	v_lt(a, b)			lane mask of a < b
+ *	v_blend(m, a, b)	b where m is set, a elsewhere
+ *	v_round(a)			round to nearest integer
+ *	v_ldexp(a, n)		a * 2^n, n integral and within the normal range
+ *	v_frexp(a, e)		mantissa in [0.5, 1), exponent stored in *e
+ *	v_flags(p)			lane mask of p[i] != 0 for FR_VW ints
+ *
+ * The exp() and log() kernels are the Cephes rational approximations,
+ * good to about one ulp over the ranges the pricing kernels use. They
+ * do not handle NaN, infinity or non-positive log() arguments; the
+ * batch callers validate their input first.
+ */
+
+static FR_V FR_ISA(vexp)(FR_V x)
+{
+	FR_V n, xx, px, qx, n1;
+
+	/*
+	 * Keep 2^n inside the normal range, exp(-708) is ~1e-308. Near the
+	 * top n reaches 1024, so the result is scaled by 2^min(n, 1023) and
+	 * then by 2 for the rest, which overflows to infinity past
+	 * log(DBL_MAX) ~ 709.78 as exp() does; larger x are clamped to 710,
+	 * already infinite.
+	 */
+	x = v_min(v_max(x, v_set1(-708.0)), v_set1(710.0));
+
+	n = v_round(v_mul(x, v_set1(1.4426950408889634073599)));
+	x = v_sub(x, v_mul(n, v_set1(6.93145751953125E-1)));
+	x = v_sub(x, v_mul(n, v_set1(1.42860682030941723212E-6)));
+
+	xx = v_mul(x, x);
+	px = v_mul(x, v_fma(v_fma(v_set1(1.26177193074810590878E-4), xx,
+		v_set1(3.02994407707441961300E-2)), xx,
+		v_set1(9.99999999999999999910E-1)));
+	qx = v_fma(v_fma(v_fma(v_set1(3.00198505138664455042E-6), xx,
+		v_set1(2.52448340349684104192E-3)), xx,
+		v_set1(2.27265548208155028766E-1)), xx,
+		v_set1(2.00000000000000000009E0));
+
+	x = v_div(px, v_sub(qx, px));
+	x = v_fma(x, v_set1(2.0), v_set1(1.0));
+	n1 = v_min(n, v_set1(1023.0));
+	return v_mul(v_ldexp(x, n1), v_add(v_sub(n, n1), v_set1(1.0)));
+}
+
+static FR_V FR_ISA(vlog)(FR_V x)
+{
+	FR_V e, y, z, p, q;
+	FR_VM small;
+
+	x = v_frexp(x, &e);
+
+	/* Fold the mantissa into [sqrt(0.5), sqrt(2)) around 1.0 */
+	small = v_lt(x, v_set1(0.70710678118654752440));
+	e = v_blend(small, e, v_sub(e, v_set1(1.0)));
+	x = v_blend(small, v_sub(x, v_set1(1.0)), v_sub(v_add(x, x), v_set1(1.0)));
+
+	z = v_mul(x, x);
+	p = v_fma(v_fma(v_fma(v_fma(v_fma(v_set1(1.01875663804580931796E-4), x,
+		v_set1(4.97494994976747001425E-1)), x,
+		v_set1(4.70579119878881725854E0)), x,
+		v_set1(1.44989225341610930846E1)), x,
+		v_set1(1.79368678507819816313E1)), x,
+		v_set1(7.70838733755885391666E0));
+	q = v_fma(v_fma(v_fma(v_fma(v_add(x,
+		v_set1(1.12873587189167450590E1)), x,
+		v_set1(4.52279145837532221105E1)), x,
+		v_set1(8.29875266912776603211E1)), x,
+		v_set1(7.11544750618563894466E1)), x,
+		v_set1(2.31251620126765340583E1));
+
+	y = v_mul(x, v_div(v_mul(z, p), q));
+	y = v_fma(e, v_set1(-2.121944400546905827679e-4), y);
+	y = v_fma(z, v_set1(-0.5), y);
+	z = v_add(x, y);
+	return v_fma(e, v_set1(0.693359375), z);
+}
+
+/* Same A&S 26.2.17 polynomial as cnd_fast(), evaluated in Horner form */
+static FR_V FR_ISA(vcnd_as)(FR_V x)
+{
+	const FR_V one = v_set1(1.0);
+	FR_V L, K, poly, result;
+
+	L = v_abs(x);
+	K = v_div(one, v_fma(v_set1(0.2316419), L, one));
+	poly = v_fma(K, v_set1(+1.330274429), v_set1(-1.821255978));
+	poly = v_fma(K, poly, v_set1(+1.781477937));
+	poly = v_fma(K, poly, v_set1(-0.356563782));
+	poly = v_fma(K, poly, v_set1(+0.31938153));
+	poly = v_mul(K, poly);
+
+	result = v_sub(one, v_mul(v_mul(v_set1(one_div_sqrt2pi),
+		FR_ISA(vexp)(v_mul(v_mul(L, L), v_set1(-0.5)))), poly));
+
+	return v_blend(v_lt(x, v_set1(0.0)), result, v_sub(one, result));
+}
+
+/* cnd_hart() with both ranges evaluated and blended */
+static FR_V FR_ISA(vcnd_hart)(FR_V x)
+{
+	const FR_V one = v_set1(1.0);
+	FR_V L, e, num, den, near, far, tail;
+
+	L = v_abs(x);
+	e = FR_ISA(vexp)(v_mul(v_mul(L, L), v_set1(-0.5)));
+
+	num = v_fma(v_set1(3.52624965998911E-02), L, v_set1(0.700383064443688));
+	num = v_fma(num, L, v_set1(6.37396220353165));
+	num = v_fma(num, L, v_set1(33.912866078383));
+	num = v_fma(num, L, v_set1(112.079291497871));
+	num = v_fma(num, L, v_set1(221.213596169931));
+	num = v_fma(num, L, v_set1(220.206867912376));
+	den = v_fma(v_set1(8.83883476483184E-02), L, v_set1(1.75566716318264));
+	den = v_fma(den, L, v_set1(16.064177579207));
+	den = v_fma(den, L, v_set1(86.7807322029461));
+	den = v_fma(den, L, v_set1(296.564248779674));
+	den = v_fma(den, L, v_set1(637.333633378831));
+	den = v_fma(den, L, v_set1(793.826512519948));
+	den = v_fma(den, L, v_set1(440.413735824752));
+	near = v_div(v_mul(e, num), den);
+
+	den = v_add(L, v_set1(0.65));
+	den = v_add(L, v_div(v_set1(4.0), den));
+	den = v_add(L, v_div(v_set1(3.0), den));
+	den = v_add(L, v_div(v_set1(2.0), den));
+	den = v_add(L, v_div(v_set1(1.0), den));
+	far = v_div(e, v_mul(den, v_set1(sqrt2pi)));
+
+	tail = v_blend(v_lt(L, v_set1(7.07106781186547)), far, near);
+	tail = v_blend(v_lt(v_set1(37.0), L), tail, v_set1(0.0));
+	return v_blend(v_lt(v_set1(0.0), x), tail, v_sub(one, tail));
+}
+
+/* erfc() has no vector form here, the lanes go through the C library */
+static FR_V FR_ISA(vcnd_erfc)(FR_V x)
+{
+	double lanes[FR_VW];
+	int j;
+
+	v_storeu(lanes, x);
+	for(j = 0; j < FR_VW; j++)
+		lanes[j] = cnd_erfc(lanes[j]);
+	return v_loadu(lanes);
+}
+
+/* The implementation fin_recipe_set_cnd() selected */
+static FR_V FR_ISA(vcnd)(FR_V x)
+{
+	switch(cnd_mode) {
+		case FIN_RECIPE_CND_HART:	return FR_ISA(vcnd_hart)(x);
+		case FIN_RECIPE_CND_ERFC:	return FR_ISA(vcnd_erfc)(x);
+		default:					return FR_ISA(vcnd_as)(x);
+	}
+}
+
+static FR_V FR_ISA(vnormdist)(FR_V x)
+{
+	return v_mul(v_set1(one_div_sqrt2pi),
+		FR_ISA(vexp)(v_mul(v_mul(x, x), v_set1(-0.5))));
+}
+
+/*
+ * gbs() for FR_VW options at once. The call/put branch is folded into a
+ * sign: with w = +1 for calls and -1 for puts both payoffs read
+ * w * (S * ebrt * cnd(w * d1) - X * ert * cnd(w * d2)).
+ */
+static FR_V FR_ISA(vgbs)(FR_VM call, FR_V S, FR_V X, FR_V T, FR_V r, FR_V b, FR_V v)
+{
+	FR_V vst, d1, d2, ebrt, ert, w;
+
+	vst = v_mul(v, v_sqrt(T));
+	d1 = v_div(v_fma(v_fma(v_mul(v, v), v_set1(0.5), b), T,
+		FR_ISA(vlog)(v_div(S, X))), vst);
+	d2 = v_sub(d1, vst);
+	ebrt = FR_ISA(vexp)(v_mul(v_sub(b, r), T));
+	ert = FR_ISA(vexp)(v_mul(v_sub(v_set1(0.0), r), T));
+
+	w = v_blend(call, v_set1(-1.0), v_set1(1.0));
+	return v_mul(w, v_sub(
+		v_mul(v_mul(S, ebrt), FR_ISA(vcnd)(v_mul(w, d1))),
+		v_mul(v_mul(X, ert), FR_ISA(vcnd)(v_mul(w, d2)))));
+}
+
+/*
+ * vgbs() for strikes sharing T, r, b and v, with the terms that depend
+ * only on those precomputed by an expiry_slice.
+ */
+static FR_V FR_ISA(vgbs_slice)(FR_VM call, FR_V S, FR_V X,
+	FR_V vst, FR_V drift, FR_V Sebrt, FR_V ert)
+{
+	FR_V d1, d2, w;
+
+	d1 = v_div(v_add(FR_ISA(vlog)(v_div(S, X)), drift), vst);
+	d2 = v_sub(d1, vst);
+
+	w = v_blend(call, v_set1(-1.0), v_set1(1.0));
+	return v_mul(w, v_sub(
+		v_mul(Sebrt, FR_ISA(vcnd)(v_mul(w, d1))),
+		v_mul(v_mul(X, ert), FR_ISA(vcnd)(v_mul(w, d2)))));
+}
+
+static void FR_ISA(cnd_batch)(int n, const double *x, double *out)
+{
+	double tail[FR_VW];
+	int i, j;
+
+	for(i = 0; i + FR_VW <= n; i += FR_VW)
+		v_storeu(out + i, FR_ISA(vcnd)(v_loadu(x + i)));
+
+	if(i < n) {
+		for(j = 0; j < FR_VW; j++)
+			tail[j] = i + j < n ? x[i + j] : 0.0;
+		v_storeu(tail, FR_ISA(vcnd)(v_loadu(tail)));
+		for(j = 0; i + j < n; j++)
+			out[i + j] = tail[j];
+	}
+}
+
+static void FR_ISA(normdist_batch)(int n, const double *x, double *out)
+{
+	double tail[FR_VW];
+	int i, j;
+
+	for(i = 0; i + FR_VW <= n; i += FR_VW)
+		v_storeu(out + i, FR_ISA(vnormdist)(v_loadu(x + i)));
+
+	if(i < n) {
+		for(j = 0; j < FR_VW; j++)
+			tail[j] = i + j < n ? x[i + j] : 0.0;
+		v_storeu(tail, FR_ISA(vnormdist)(v_loadu(tail)));
+		for(j = 0; i + j < n; j++)
+			out[i + j] = tail[j];
+	}
+}
+
+/* cnd_inv() with both branches evaluated and blended */
+static FR_V FR_ISA(vcnd_inv)(FR_V p)
+{
+	const FR_V pt = v_min(p, v_sub(v_set1(1.0), p));
+	const FR_V q = v_sqrt(v_mul(v_set1(-2.0), FR_ISA(vlog)(pt)));
+	const FR_V c = v_sub(p, v_set1(0.5));
+	const FR_V x = v_mul(c, c);
+	FR_V tail, central;
+
+	tail = v_div(
+		v_fma(v_fma(v_fma(v_fma(v_fma(v_set1(acklam_c[0]), q, v_set1(acklam_c[1])), q,
+			v_set1(acklam_c[2])), q, v_set1(acklam_c[3])), q, v_set1(acklam_c[4])), q, v_set1(acklam_c[5])),
+		v_fma(v_fma(v_fma(v_fma(v_set1(acklam_d[0]), q, v_set1(acklam_d[1])), q,
+			v_set1(acklam_d[2])), q, v_set1(acklam_d[3])), q, v_set1(1.0)));
+	tail = v_mul(tail, v_blend(v_lt(v_set1(0.5), p), v_set1(1.0), v_set1(-1.0)));
+
+	central = v_div(
+		v_mul(v_fma(v_fma(v_fma(v_fma(v_fma(v_set1(acklam_a[0]), x, v_set1(acklam_a[1])), x,
+			v_set1(acklam_a[2])), x, v_set1(acklam_a[3])), x, v_set1(acklam_a[4])), x, v_set1(acklam_a[5])), c),
+		v_fma(v_fma(v_fma(v_fma(v_fma(v_set1(acklam_b[0]), x, v_set1(acklam_b[1])), x,
+			v_set1(acklam_b[2])), x, v_set1(acklam_b[3])), x, v_set1(acklam_b[4])), x, v_set1(1.0)));
+
+	return v_blend(v_lt(pt, v_set1(ACKLAM_P_LOW)), central, tail);
+}
+
+static void FR_ISA(cnd_inv_batch)(int n, const double *x, double *out)
+{
+	double tail[FR_VW];
+	int i, j;
+
+	for(i = 0; i + FR_VW <= n; i += FR_VW)
+		v_storeu(out + i, FR_ISA(vcnd_inv)(v_loadu(x + i)));
+
+	if(i < n) {
+		for(j = 0; j < FR_VW; j++)
+			tail[j] = i + j < n ? x[i + j] : 0.5;
+		v_storeu(tail, FR_ISA(vcnd_inv)(v_loadu(tail)));
+		for(j = 0; i + j < n; j++)
+			out[i + j] = tail[j];
+	}
+}
+
+static void FR_ISA(exp_batch)(int n, const double *x, double *out)
+{
+	double tail[FR_VW];
+	int i, j;
+
+	for(i = 0; i + FR_VW <= n; i += FR_VW)
+		v_storeu(out + i, FR_ISA(vexp)(v_loadu(x + i)));
+
+	if(i < n) {
+		for(j = 0; j < FR_VW; j++)
+			tail[j] = i + j < n ? x[i + j] : 0.0;
+		v_storeu(tail, FR_ISA(vexp)(v_loadu(tail)));
+		for(j = 0; i + j < n; j++)
+			out[i + j] = tail[j];
+	}
+}
+
+static void FR_ISA(gbs_batch)(
+	int n,
+	const int *fCall,
+	const double *S,
+	const double *X,
+	const double *T,
+	const double *r,
+	const double *b,
+	const double *v,
+	double *out)
+{
+	int i, j;
+
+	for(i = 0; i + FR_VW <= n; i += FR_VW)
+		v_storeu(out + i, FR_ISA(vgbs)(v_flags(fCall + i),
+			v_loadu(S + i), v_loadu(X + i), v_loadu(T + i),
+			v_loadu(r + i), v_loadu(b + i), v_loadu(v + i)));
+
+	if(i < n) {
+		/* Pad the last partial vector by repeating its first option */
+		int tfCall[FR_VW];
+		double tS[FR_VW], tX[FR_VW], tT[FR_VW], tr[FR_VW], tb[FR_VW], tv[FR_VW];
+
+		for(j = 0; j < FR_VW; j++) {
+			const int k = i + j < n ? i + j : i;
+			tfCall[j] = fCall[k];
+			tS[j] = S[k]; tX[j] = X[k]; tT[j] = T[k];
+			tr[j] = r[k]; tb[j] = b[k]; tv[j] = v[k];
+		}
+		v_storeu(tS, FR_ISA(vgbs)(v_flags(tfCall),
+			v_loadu(tS), v_loadu(tX), v_loadu(tT),
+			v_loadu(tr), v_loadu(tb), v_loadu(tv)));
+		for(j = 0; i + j < n; j++)
+			out[i + j] = tS[j];
+	}
+}
+
+static void FR_ISA(gbs_slice)(
+	int n,
+	const int *fCall,
+	double S,
+	const double *X,
+	double vst,
+	double drift,
+	double ebrt,
+	double ert,
+	double *out)
+{
+	const FR_V vS = v_set1(S), vvst = v_set1(vst), vdrift = v_set1(drift);
+	const FR_V vSebrt = v_set1(S * ebrt), vert = v_set1(ert);
+	int i, j;
+
+	for(i = 0; i + FR_VW <= n; i += FR_VW)
+		v_storeu(out + i, FR_ISA(vgbs_slice)(v_flags(fCall + i), vS,
+			v_loadu(X + i), vvst, vdrift, vSebrt, vert));
+
+	if(i < n) {
+		int tfCall[FR_VW];
+		double tX[FR_VW];
+
+		for(j = 0; j < FR_VW; j++) {
+			const int k = i + j < n ? i + j : i;
+			tfCall[j] = fCall[k];
+			tX[j] = X[k];
+		}
+		v_storeu(tX, FR_ISA(vgbs_slice)(v_flags(tfCall), vS,
+			v_loadu(tX), vvst, vdrift, vSebrt, vert));
+		for(j = 0; i + j < n; j++)
+			out[i + j] = tX[j];
+	}
+}
+
+static void FR_ISA(gbs_spot)(
+	int n,
+	int fCall,
+	const double *S,
+	const double *lSX,
+	double X,
+	double vst,
+	double drift,
+	double ebrt,
+	double ert,
+	double *out)
+{
+	const FR_V w = v_set1(fCall ? 1.0 : -1.0), vvst = v_set1(vst), vdrift = v_set1(drift);
+	const FR_V vinv = v_set1(1.0 / vst), vebrt = v_set1(ebrt), vXert = v_set1(X * ert);
+	FR_V d1, d2;
+	double tS[FR_VW], tl[FR_VW];
+	int i, j;
+
+	for(i = 0; i < n; i += FR_VW) {
+		const double *pS = S + i, *pl = lSX + i;
+
+		if(i + FR_VW > n) {
+			for(j = 0; j < FR_VW; j++) {
+				tS[j] = S[i + j < n ? i + j : i];
+				tl[j] = lSX[i + j < n ? i + j : i];
+			}
+			pS = tS;
+			pl = tl;
+		}
+		d1 = v_mul(v_add(v_loadu(pl), vdrift), vinv);
+		d2 = v_sub(d1, vvst);
+		d1 = v_mul(w, v_sub(
+			v_mul(v_mul(v_loadu(pS), vebrt), FR_ISA(vcnd)(v_mul(w, d1))),
+			v_mul(vXert, FR_ISA(vcnd)(v_mul(w, d2)))));
+		if(pS == tS) {
+			v_storeu(tS, d1);
+			for(j = 0; i + j < n; j++)
+				out[i + j] = tS[j];
+		} else
+			v_storeu(out + i, d1);
+	}
+}
+
+/* tree_lanes() of a full block, TREE_LANES / FR_VW vectors per node */
+static void FR_ISA(tree_block)(const tree_block *t, int steps, double *V, double *out)
+{
+	enum { NV = TREE_LANES / FR_VW };
+	FR_V X[NV], phi[NV], dinv[NV], ud[NV], pu[NV], pd[NV], s[NV], bottom[NV];
+	const FR_V zero = v_set1(0.0);
+	int i, j, k;
+
+	for(k = 0; k < NV; k++) {
+		X[k] = v_loadu(t->X + k * FR_VW);
+		phi[k] = v_loadu(t->phi + k * FR_VW);
+		dinv[k] = v_loadu(t->dinv + k * FR_VW);
+		ud[k] = v_loadu(t->ud + k * FR_VW);
+		pu[k] = v_loadu(t->pu + k * FR_VW);
+		pd[k] = v_loadu(t->pd + k * FR_VW);
+		s[k] = bottom[k] = v_loadu(t->Sd + k * FR_VW);
+	}
+
+	for(j = 0; j <= steps; j++)
+		for(k = 0; k < NV; k++) {
+			v_storeu(V + j * TREE_LANES + k * FR_VW, v_max(v_mul(phi[k], v_sub(s[k], X[k])), zero));
+			s[k] = v_mul(s[k], ud[k]);
+		}
+
+	for(i = steps - 1; i >= 0; i--) {
+		for(k = 0; k < NV; k++)
+			s[k] = bottom[k] = v_mul(bottom[k], dinv[k]);
+		for(j = 0; j <= i; j++)
+			for(k = 0; k < NV; k++) {
+				double *node = V + j * TREE_LANES + k * FR_VW;
+				const FR_V hold = v_fma(pu[k], v_loadu(node + TREE_LANES), v_mul(pd[k], v_loadu(node)));
+
+				v_storeu(node, v_max(hold, v_mul(phi[k], v_sub(s[k], X[k]))));
+				s[k] = v_mul(s[k], ud[k]);
+			}
+	}
+
+	for(k = 0; k < NV; k++)
+		v_storeu(out + k * FR_VW, v_loadu(V + k * FR_VW));
+}
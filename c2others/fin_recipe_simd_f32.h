@@ -0,0 +1,168 @@
+/*
+ * Single precision SIMD kernel template for fin_recipe_source.c.
+ *
+ * Included once per instruction set right after fin_recipe_simd.h, the
+ * same way and with the same FR_ISA() suffixing, but over vectors of
+ * floats: an AVX2 vector holds 8 of them and an AVX-512 vector 16, twice
+ * the options per instruction of the double kernels, from half the
+ * memory. Meant for screening and heatmaps; prices are good to about
+ * 1e-6 relative to S, see the validation in bench_fin_recipe.c.
+ *
+ * Required definitions:
+ *	FR_F			vector of floats
+ *	FR_FM			lane mask as returned by f_lt()/f_flags()
+ *	FR_FW			number of lanes
+ *	FR_ISA(name)	name with the instruction set suffix
+ *	f_set1(x) f_loadu(p) f_storeu(p, a)
+ *	f_add f_sub f_mul f_div f_min f_max f_sqrt f_abs
+ *	f_fma(a, b, c)		a * b + c
+ *	f_lt(a, b)			lane mask of a < b
+ *	f_blend(m, a, b)	b where m is set, a elsewhere
+ *	f_round(a)			round to nearest integer
+ *	f_ldexp(a, n)		a * 2^n, n integral and within the normal range
+ *	f_frexp(a, e)		mantissa in [0.5, 1), exponent stored in *e
+ *	f_flags(p)			lane mask of p[i] != 0 for FR_FW ints
+ *
+ * exp() and log() are the Cephes expf() and logf() polynomials, cnd() is
+ * the A&S 26.2.17 polynomial of cnd_fast() whatever fin_recipe_set_cnd()
+ * selected: the other implementations buy digits a float cannot hold.
+ */
+
+static FR_F FR_ISA(vexp_f32)(FR_F x)
+{
+	FR_F n, p, n1;
+
+	/* The same overflow to infinity as vexp(), past log(FLT_MAX) ~ 88.72 */
+	x = f_min(f_max(x, f_set1(-87.0f)), f_set1(89.0f));
+
+	n = f_round(f_mul(x, f_set1(1.44269504088896341f)));
+	x = f_sub(x, f_mul(n, f_set1(0.693359375f)));
+	x = f_sub(x, f_mul(n, f_set1(-2.12194440e-4f)));
+
+	p = f_fma(f_set1(1.9875691500E-4f), x, f_set1(1.3981999507E-3f));
+	p = f_fma(p, x, f_set1(8.3334519073E-3f));
+	p = f_fma(p, x, f_set1(4.1665795894E-2f));
+	p = f_fma(p, x, f_set1(1.6666665459E-1f));
+	p = f_fma(p, x, f_set1(5.0000001201E-1f));
+	p = f_fma(f_mul(p, x), x, f_add(x, f_set1(1.0f)));
+	n1 = f_min(n, f_set1(127.0f));
+	return f_mul(f_ldexp(p, n1), f_add(f_sub(n, n1), f_set1(1.0f)));
+}
+
+static FR_F FR_ISA(vlog_f32)(FR_F x)
+{
+	FR_F e, z, p;
+	FR_FM small;
+
+	x = f_frexp(x, &e);
+
+	small = f_lt(x, f_set1(0.707106781186547524f));
+	e = f_blend(small, e, f_sub(e, f_set1(1.0f)));
+	x = f_blend(small, f_sub(x, f_set1(1.0f)), f_sub(f_add(x, x), f_set1(1.0f)));
+
+	z = f_mul(x, x);
+	p = f_fma(f_set1(7.0376836292E-2f), x, f_set1(-1.1514610310E-1f));
+	p = f_fma(p, x, f_set1(1.1676998740E-1f));
+	p = f_fma(p, x, f_set1(-1.2420140846E-1f));
+	p = f_fma(p, x, f_set1(1.4249322787E-1f));
+	p = f_fma(p, x, f_set1(-1.6668057665E-1f));
+	p = f_fma(p, x, f_set1(2.0000714765E-1f));
+	p = f_fma(p, x, f_set1(-2.4999993993E-1f));
+	p = f_fma(p, x, f_set1(3.3333331174E-1f));
+	p = f_mul(f_mul(p, x), z);
+
+	p = f_fma(e, f_set1(-2.12194440e-4f), p);
+	p = f_fma(z, f_set1(-0.5f), p);
+	return f_fma(e, f_set1(0.693359375f), f_add(x, p));
+}
+
+static FR_F FR_ISA(vcnd_f32)(FR_F x)
+{
+	const FR_F one = f_set1(1.0f);
+	FR_F L, K, poly, p;
+
+	L = f_abs(x);
+	K = f_div(one, f_fma(f_set1(0.2316419f), L, one));
+	poly = f_fma(K, f_set1(+1.330274429f), f_set1(-1.821255978f));
+	poly = f_fma(K, poly, f_set1(+1.781477937f));
+	poly = f_fma(K, poly, f_set1(-0.356563782f));
+	poly = f_fma(K, poly, f_set1(+0.31938153f));
+	poly = f_mul(K, poly);
+
+	/* The tail itself for x < 0, not 1 - (1 - tail), which a float rounds to 0 */
+	p = f_mul(f_mul(f_set1((float)one_div_sqrt2pi),
+		FR_ISA(vexp_f32)(f_mul(f_mul(L, L), f_set1(-0.5f)))), poly);
+
+	return f_blend(f_lt(x, f_set1(0.0f)), f_sub(one, p), p);
+}
+
+/* vgbs() in single precision */
+static FR_F FR_ISA(vgbs_f32)(FR_FM call, FR_F S, FR_F X, FR_F T, FR_F r, FR_F b, FR_F v)
+{
+	FR_F vst, d1, d2, ebrt, ert, w;
+
+	vst = f_mul(v, f_sqrt(T));
+	d1 = f_div(f_fma(f_fma(f_mul(v, v), f_set1(0.5f), b), T,
+		FR_ISA(vlog_f32)(f_div(S, X))), vst);
+	d2 = f_sub(d1, vst);
+	ebrt = FR_ISA(vexp_f32)(f_mul(f_sub(b, r), T));
+	ert = FR_ISA(vexp_f32)(f_mul(f_sub(f_set1(0.0f), r), T));
+
+	w = f_blend(call, f_set1(-1.0f), f_set1(1.0f));
+	return f_mul(w, f_sub(
+		f_mul(f_mul(S, ebrt), FR_ISA(vcnd_f32)(f_mul(w, d1))),
+		f_mul(f_mul(X, ert), FR_ISA(vcnd_f32)(f_mul(w, d2)))));
+}
+
+static void FR_ISA(cnd_batch_f32)(int n, const float *x, float *out)
+{
+	float tail[FR_FW];
+	int i, j;
+
+	for(i = 0; i + FR_FW <= n; i += FR_FW)
+		f_storeu(out + i, FR_ISA(vcnd_f32)(f_loadu(x + i)));
+
+	if(i < n) {
+		for(j = 0; j < FR_FW; j++)
+			tail[j] = i + j < n ? x[i + j] : 0.0f;
+		f_storeu(tail, FR_ISA(vcnd_f32)(f_loadu(tail)));
+		for(j = 0; i + j < n; j++)
+			out[i + j] = tail[j];
+	}
+}
+
+static void FR_ISA(gbs_batch_f32)(
+	int n,
+	const int *fCall,
+	const float *S,
+	const float *X,
+	const float *T,
+	const float *r,
+	const float *b,
+	const float *v,
+	float *out)
+{
+	int i, j;
+
+	for(i = 0; i + FR_FW <= n; i += FR_FW)
+		f_storeu(out + i, FR_ISA(vgbs_f32)(f_flags(fCall + i), f_loadu(S + i), f_loadu(X + i),
+			f_loadu(T + i), f_loadu(r + i), f_loadu(b + i), f_loadu(v + i)));
+
+	/* Pad the tail with copies of its first row, which is known to be valid */
+	if(i < n) {
+		int tfCall[FR_FW];
+		float tS[FR_FW], tX[FR_FW], tT[FR_FW], tr[FR_FW], tb[FR_FW], tv[FR_FW];
+
+		for(j = 0; j < FR_FW; j++) {
+			const int k = i + j < n ? i + j : i;
+
+			tfCall[j] = fCall[k];
+			tS[j] = S[k]; tX[j] = X[k]; tT[j] = T[k];
+			tr[j] = r[k]; tb[j] = b[k]; tv[j] = v[k];
+		}
+		f_storeu(tS, FR_ISA(vgbs_f32)(f_flags(tfCall), f_loadu(tS), f_loadu(tX),
+			f_loadu(tT), f_loadu(tr), f_loadu(tb), f_loadu(tv)));
+		for(j = 0; i + j < n; j++)
+			out[i + j] = tS[j];
+	}
+}
@@ -0,0 +1,347 @@
+/*
+ * Streaming pricer for files too big to load: prices a binary columnar
+ * file of options into a binary file of prices, both memory mapped, one
+ * cache-sized block of rows at a time.
+ *
+ * The input holds n rows as seven consecutive columns in native byte
+ * order, 52 bytes a row:
+ *
+ *	double S[n], X[n], T[n], r[n], b[n], v[n];
+ *	int32 fCall[n];
+ *
+ * fCall comes last so the doubles stay 8-byte aligned. numpy writes it
+ * with np.concatenate([S, X, T, r, b, v]).tofile(f) followed by
+ * fCall.astype(np.int32).tofile(f). The output is double out[n], NaN in
+ * the rows the *_batch_checked functions reject; their count goes to
+ * stderr with the timing.
+ *
+ * Every block goes straight from the input mapping through the checked
+ * batch, split over the thread pool, into the output mapping. Before a
+ * block is priced the kernel is asked to read the next one ahead, and
+ * once it is priced its pages are dropped from both mappings, so reading
+ * overlaps pricing and the resident set stays at a few blocks whatever
+ * the size of the files. The default block is 16384 rows, 1 MB of
+ * columns, per thread. Files over 2 GB need a 64-bit build.
+ *
+ * cc -O2 -o fin_recipe_stream fin_recipe_stream.c fin_recipe.dll
+ * fin_recipe_stream [--model gbs|american|american2002] [--block N] [--threads N] input output
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "fin_recipe.h"
+
+#define ROW_BYTES	(6 * sizeof(double) + sizeof(int))
+
+typedef int (*checked_fn)(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *v, double *out, int *status);
+
+static const struct {
+	const char *name;
+	checked_fn fn;
+} models[] = {
+	{ "gbs", gbs_batch_checked },
+	{ "american", BSAmericanApprox_batch_checked },
+	{ "american2002", BSAmericanApprox2002_batch_checked }
+};
+
+typedef struct mapping {
+	char *base;
+	size_t size;
+#if defined(_WIN32)
+	HANDLE file, map;
+#else
+	int fd;
+#endif
+} mapping;
+
+static double now_ns(void)
+{
+#if defined(_WIN32)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER t;
+
+	if(!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart * 1e9 / (double)freq.QuadPart;
+#else
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+#endif
+}
+
+static size_t page_size(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	return si.dwPageSize;
+#else
+	const long n = sysconf(_SC_PAGESIZE);
+
+	return n > 0 ? (size_t)n : 4096;
+#endif
+}
+
+/* Map the whole of path read-only, hinting at sequential access */
+static int map_input(mapping *m, const char *path)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER size;
+
+	m->base = NULL;
+	m->map = NULL;
+	m->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(m->file == INVALID_HANDLE_VALUE)
+		return 0;
+	if(!GetFileSizeEx(m->file, &size) || (unsigned long long)size.QuadPart > (size_t)-1)
+		return 0;
+	m->size = (size_t)size.QuadPart;
+	if(m->size == 0)
+		return 1;
+	if((m->map = CreateFileMappingA(m->file, NULL, PAGE_READONLY, 0, 0, NULL)) == NULL)
+		return 0;
+	m->base = MapViewOfFile(m->map, FILE_MAP_READ, 0, 0, 0);
+	return m->base != NULL;
+#else
+	struct stat st;
+
+	m->base = NULL;
+	if((m->fd = open(path, O_RDONLY)) < 0 || fstat(m->fd, &st) != 0)
+		return 0;
+	if((unsigned long long)st.st_size > (size_t)-1)
+		return 0;
+	m->size = (size_t)st.st_size;
+	if(m->size == 0)
+		return 1;
+	if((m->base = mmap(NULL, m->size, PROT_READ, MAP_SHARED, m->fd, 0)) == MAP_FAILED) {
+		m->base = NULL;
+		return 0;
+	}
+	madvise(m->base, m->size, MADV_SEQUENTIAL);
+	return 1;
+#endif
+}
+
+/* Create or truncate path to size bytes and map it writable */
+static int map_output(mapping *m, const char *path, size_t size)
+{
+#if defined(_WIN32)
+	m->base = NULL;
+	m->map = NULL;
+	m->size = size;
+	m->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if(m->file == INVALID_HANDLE_VALUE)
+		return 0;
+	if(size == 0)
+		return 1;
+	m->map = CreateFileMappingA(m->file, NULL, PAGE_READWRITE,
+		(DWORD)((unsigned long long)size >> 32), (DWORD)size, NULL);
+	if(m->map == NULL)
+		return 0;
+	m->base = MapViewOfFile(m->map, FILE_MAP_WRITE, 0, 0, 0);
+	return m->base != NULL;
+#else
+	m->base = NULL;
+	m->size = size;
+	if((m->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0)
+		return 0;
+	if(ftruncate(m->fd, (off_t)size) != 0)
+		return 0;
+	if(size == 0)
+		return 1;
+	if((m->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0)) == MAP_FAILED) {
+		m->base = NULL;
+		return 0;
+	}
+	return 1;
+#endif
+}
+
+/* Unmap and close, returns 0 if the data of a writable mapping could not be flushed */
+static int unmap(mapping *m, int flush)
+{
+	int ok = 1;
+
+#if defined(_WIN32)
+	if(m->base != NULL) {
+		if(flush)
+			ok = FlushViewOfFile(m->base, 0) != 0;
+		UnmapViewOfFile(m->base);
+	}
+	if(m->map != NULL)
+		CloseHandle(m->map);
+	if(m->file != INVALID_HANDLE_VALUE)
+		CloseHandle(m->file);
+#else
+	if(m->base != NULL) {
+		if(flush)
+			ok = msync(m->base, m->size, MS_SYNC) == 0;
+		munmap(m->base, m->size);
+	}
+	if(m->fd >= 0)
+		close(m->fd);
+#endif
+	return ok;
+}
+
+/* Ask for [p, p + len) to be read in the background */
+static void prefetch(const char *p, size_t len, size_t page)
+{
+#if defined(_WIN32)
+	(void)p; (void)len; (void)page;		/* FILE_FLAG_SEQUENTIAL_SCAN reads ahead */
+#else
+	const size_t skew = (size_t)p % page;
+
+	if(len > 0)
+		madvise((void *)(p - skew), len + skew, MADV_WILLNEED);
+#endif
+}
+
+/*
+ * Drop the whole pages of [p, p + len) from the mapping. Their data stays
+ * in the file, or in the page cache on its way there.
+ */
+static void release(const char *p, size_t len, size_t page)
+{
+	const size_t first = ((size_t)p + page - 1) / page * page;
+	const size_t last = ((size_t)p + len) / page * page;
+
+	if(last <= first)
+		return;
+#if defined(_WIN32)
+	/* Unlocking pages that are not locked takes them out of the working set */
+	VirtualUnlock((void *)first, last - first);
+#else
+	madvise((void *)first, last - first, MADV_DONTNEED);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	const char *input = NULL, *output = NULL;
+	long block = 0;
+	int threads = 0, model = FIN_RECIPE_MODEL_GBS;
+	int i, k, m;
+	long long n, row, bad = 0;
+	size_t page;
+	double start, ns;
+	mapping in, out;
+	const double *col[6];
+	const int *fCall;
+	double *price;
+	int *status;
+
+	for(i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--model") && i + 1 < argc) {
+			for(++i, k = 0; k < (int)(sizeof models / sizeof *models); k++)
+				if(!strcmp(argv[i], models[k].name))
+					break;
+			if(k == (int)(sizeof models / sizeof *models))
+				break;
+			model = k;
+		} else if(!strcmp(argv[i], "--block") && i + 1 < argc)
+			block = atol(argv[++i]);
+		else if(!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if(argv[i][0] != '-' && input == NULL)
+			input = argv[i];
+		else if(argv[i][0] != '-' && output == NULL)
+			output = argv[i];
+		else
+			break;
+	}
+	if(i < argc || output == NULL) {
+		fprintf(stderr, "usage: %s [--model gbs|american|american2002] [--block N] [--threads N] input output\n",
+			argv[0]);
+		return 2;
+	}
+
+	threads = fin_recipe_set_threads(threads);
+	if(block < 1 || block > 1L << 24)
+		block = 16384L * threads;
+	page = page_size();
+
+	if(!map_input(&in, input)) {
+		fprintf(stderr, "cannot map %s\n", input);
+		unmap(&in, 0);
+		return 1;
+	}
+	if(in.size % ROW_BYTES != 0) {
+		fprintf(stderr, "%s: size %llu is not a multiple of %d bytes a row\n",
+			input, (unsigned long long)in.size, (int)ROW_BYTES);
+		unmap(&in, 0);
+		return 1;
+	}
+	n = (long long)(in.size / ROW_BYTES);
+	if(!map_output(&out, output, (size_t)n * sizeof(double))) {
+		fprintf(stderr, "cannot map %s for %lld rows\n", output, n);
+		unmap(&out, 0);
+		unmap(&in, 0);
+		return 1;
+	}
+	if((status = malloc((size_t)block * sizeof(int))) == NULL) {
+		fprintf(stderr, "out of memory for a block of %ld rows\n", block);
+		unmap(&out, 0);
+		unmap(&in, 0);
+		return 1;
+	}
+
+	for(k = 0; k < 6; k++)
+		col[k] = (const double *)in.base + (size_t)k * n;
+	fCall = (const int *)(col[0] + (size_t)6 * n);
+	price = (double *)out.base;
+
+	start = now_ns();
+	for(row = 0; row < n; row += m) {
+		const long long next = row + block;
+
+		m = n - row < block ? (int)(n - row) : (int)block;
+		if(next < n) {
+			const size_t ahead = n - next < block ? (size_t)(n - next) : (size_t)block;
+
+			for(k = 0; k < 6; k++)
+				prefetch((const char *)(col[k] + next), ahead * sizeof(double), page);
+			prefetch((const char *)(fCall + next), ahead * sizeof(int), page);
+		}
+
+		bad += models[model].fn(m, fCall + row, col[0] + row, col[1] + row, col[2] + row,
+			col[3] + row, col[4] + row, col[5] + row, price + row, status);
+
+		for(k = 0; k < 6; k++)
+			release((const char *)(col[k] + row), (size_t)m * sizeof(double), page);
+		release((const char *)(fCall + row), (size_t)m * sizeof(int), page);
+		release((const char *)(price + row), (size_t)m * sizeof(double), page);
+	}
+	ns = now_ns() - start;
+
+	free(status);
+	unmap(&in, 0);
+	if(!unmap(&out, 1)) {
+		fprintf(stderr, "cannot write %s\n", output);
+		return 1;
+	}
+
+	fprintf(stderr, "%s: %lld rows, %lld invalid, %d threads, %.3f s, %.2f ns/row\n",
+		models[model].name, n, bad, threads, ns * 1e-9, n > 0 ? ns / (double)n : 0.0);
+	return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * Excel add-in (XLL) over fin_recipe_source.c.
+ *
+ * Declare'd DLL calls from VBA are slow, run on Excel's main thread only
+ * and need a DLL of the same bitness as Excel. The XLL registers the
+ * functions with Excel directly, as thread-safe ("$" in the type string),
+ * so multithreaded recalculation spreads the cells over all cores:
+ *
+ *	=gbs(1, 42, 40, 0.75, 0.04, -0.04, 0.35)
+ *	=blackscholes(TRUE, 100, 100, 1, 0.1, 0.3)
+ *	=BSAmericanApprox(0, 42, 40, 0.75, 0.04, -0.04, 0.35)
+ *
+ * The *_array variants take ranges or array constants for any argument and
+ * return an array, so one formula prices a whole strike range:
+ *
+ *	=gbs_array(1, 42, A2:A200, 0.75, 0.04, -0.04, 0.35)
+ *
+ * Single values are broadcast against the ranges, which must all have the
+ * same number of cells; the result takes the shape of the first range.
+ * Invalid rows, and cells that are not numbers, give #NUM!.
+ *
+ * Needs xlcall.h and xlcall.cpp from the Microsoft Excel XLL SDK, which
+ * are not part of this repository; build with -DFIN_RECIPE_XLL=ON, see
+ * CMakeLists.txt. The add-in must have the bitness of Excel, so 32-bit
+ * Excel needs -DFIN_RECIPE_32BIT=ON as well.
+ */
+
+#include "fin_recipe.h"
+
+#include <windows.h>
+#include "xlcall.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ARGS 7
+#define MAX_REGISTER 10
+
+typedef int (*batch_fn)(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *v, double *out, int *status);
+
+typedef struct xl_function {
+	const char *proc;		/* exported name, see fin_recipe_xll.def */
+	const char *type;		/* return type, argument types, "$" thread-safe */
+	const char *name;		/* worksheet name */
+	const char *args;
+	const char *help;
+} xl_function;
+
+static const xl_function functions[] = {
+	{ "xl_blackscholes", "BJBBBBB$", "blackscholes", "CP,S,X,T,r,v",
+		"Black-Scholes price, CP nonzero for calls" },
+	{ "xl_gbs", "BJBBBBBB$", "gbs", "CP,S,X,T,r,b,v",
+		"Generalized Black-Scholes price with cost of carry b" },
+	{ "xl_BSAmericanApprox", "BJBBBBBB$", "BSAmericanApprox", "CP,S,X,T,r,b,v",
+		"Bjerksund-Stensland American approximation" },
+	{ "xl_blackscholes_array", "QQQQQQQ$", "blackscholes_array", "CP,S,X,T,r,v",
+		"blackscholes over ranges, returns an array" },
+	{ "xl_gbs_array", "QQQQQQQQ$", "gbs_array", "CP,S,X,T,r,b,v",
+		"gbs over ranges, returns an array" },
+	{ "xl_BSAmericanApprox_array", "QQQQQQQQ$", "BSAmericanApprox_array", "CP,S,X,T,r,b,v",
+		"BSAmericanApprox over ranges, returns an array" }
+};
+
+/* #VALUE!, for arguments that do not fit together */
+static XLOPER12 xl_error_value = { { 0 }, xltypeErr };
+
+/*
+ * Single cells go straight to the checked entry points, which keeps the
+ * asserts of the scalar functions out of Excel; Excel shows the NaN of an
+ * invalid row as #NUM!.
+ */
+double WINAPI xl_blackscholes(int CP, double S, double X, double T, double r, double v)
+{
+	double out;
+	int status;
+
+	blackscholes_batch_checked(1, &CP, &S, &X, &T, &r, &v, &out, &status);
+	return out;
+}
+
+double WINAPI xl_gbs(int CP, double S, double X, double T, double r, double b, double v)
+{
+	double out;
+	int status;
+
+	gbs_batch_checked(1, &CP, &S, &X, &T, &r, &b, &v, &out, &status);
+	return out;
+}
+
+double WINAPI xl_BSAmericanApprox(int CP, double S, double X, double T, double r, double b, double v)
+{
+	double out;
+	int status;
+
+	BSAmericanApprox_batch_checked(1, &CP, &S, &X, &T, &r, &b, &v, &out, &status);
+	return out;
+}
+
+static int blackscholes_checked(int n, const int *fCall, const double *S, const double *X,
+	const double *T, const double *r, const double *b, const double *v, double *out, int *status)
+{
+	(void)b;
+	return blackscholes_batch_checked(n, fCall, S, X, T, r, v, out, status);
+}
+
+/* Cell k of a range, or the value itself */
+static double xl_value(const XLOPER12 *x, int k)
+{
+	if(x->xltype & xltypeMulti)
+		x = &x->val.array.lparray[k];
+	switch(x->xltype & ~(xlbitXLFree | xlbitDLLFree)) {
+		case xltypeNum:		return x->val.num;
+		case xltypeInt:		return x->val.w;
+		case xltypeBool:	return x->val.xbool;
+		default:			return NAN;
+	}
+}
+
+/*
+ * The result is one block: the XLOPER12 returned to Excel followed by its
+ * cells. It is flagged xlbitDLLFree, so Excel hands it back to
+ * xlAutoFree12() once it has copied the values, which keeps the function
+ * thread safe without any shared return buffer.
+ */
+static LPXLOPER12 xl_price_array(LPXLOPER12 *args, int nargs, batch_fn batch)
+{
+	LPXLOPER12 result;
+	const XLOPER12 *shape = NULL;
+	double *cols, *out;
+	int *fCall, *status;
+	int n = 1, j, k;
+
+	for(j = 0; j < nargs; j++) {
+		if(!(args[j]->xltype & xltypeMulti))
+			continue;
+		if(shape == NULL) {
+			shape = args[j];
+			n = shape->val.array.rows * shape->val.array.columns;
+		} else if(args[j]->val.array.rows * args[j]->val.array.columns != n)
+			return &xl_error_value;
+	}
+
+	result = malloc(sizeof *result + (size_t)n * sizeof *result);
+	cols = malloc((size_t)n * (MAX_ARGS * sizeof(double) + 2 * sizeof(int)));
+	if(result == NULL || cols == NULL) {
+		free(result);
+		free(cols);
+		return &xl_error_value;
+	}
+	out = cols + (MAX_ARGS - 1) * n;
+	fCall = (int *)(out + n);
+	status = fCall + n;
+
+	/* A flag that is not a number invalidates its row through S */
+	for(k = 0; k < n; k++) {
+		double d = xl_value(args[0], k);
+
+		fCall[k] = d != 0.0;
+		for(j = 1; j < nargs; j++)
+			cols[(j - 1) * n + k] = xl_value(args[j], k);
+		if(isnan(d))
+			cols[k] = NAN;
+	}
+	/* blackscholes has no b: v moves to the last column, b is ignored */
+	if(nargs < MAX_ARGS)
+		memcpy(cols + (nargs - 1) * n, cols + (nargs - 2) * n, (size_t)n * sizeof(double));
+
+	batch(n, fCall, cols, cols + n, cols + 2 * n, cols + 3 * n, cols + 4 * n, cols + 5 * n, out, status);
+
+	result->xltype = xltypeMulti | xlbitDLLFree;
+	result->val.array.lparray = result + 1;
+	result->val.array.rows = shape != NULL ? shape->val.array.rows : 1;
+	result->val.array.columns = shape != NULL ? shape->val.array.columns : 1;
+	for(k = 0; k < n; k++) {
+		if(status[k] == 0 && isfinite(out[k])) {
+			result[k + 1].xltype = xltypeNum;
+			result[k + 1].val.num = out[k];
+		} else {
+			result[k + 1].xltype = xltypeErr;
+			result[k + 1].val.err = xlerrNum;
+		}
+	}
+	free(cols);
+	return result;
+}
+
+LPXLOPER12 WINAPI xl_blackscholes_array(LPXLOPER12 CP, LPXLOPER12 S, LPXLOPER12 X, LPXLOPER12 T,
+	LPXLOPER12 r, LPXLOPER12 v)
+{
+	LPXLOPER12 args[6];
+
+	args[0] = CP; args[1] = S; args[2] = X; args[3] = T; args[4] = r; args[5] = v;
+	return xl_price_array(args, 6, blackscholes_checked);
+}
+
+LPXLOPER12 WINAPI xl_gbs_array(LPXLOPER12 CP, LPXLOPER12 S, LPXLOPER12 X, LPXLOPER12 T,
+	LPXLOPER12 r, LPXLOPER12 b, LPXLOPER12 v)
+{
+	LPXLOPER12 args[7];
+
+	args[0] = CP; args[1] = S; args[2] = X; args[3] = T; args[4] = r; args[5] = b; args[6] = v;
+	return xl_price_array(args, 7, gbs_batch_checked);
+}
+
+LPXLOPER12 WINAPI xl_BSAmericanApprox_array(LPXLOPER12 CP, LPXLOPER12 S, LPXLOPER12 X, LPXLOPER12 T,
+	LPXLOPER12 r, LPXLOPER12 b, LPXLOPER12 v)
+{
+	LPXLOPER12 args[7];
+
+	args[0] = CP; args[1] = S; args[2] = X; args[3] = T; args[4] = r; args[5] = b; args[6] = v;
+	return xl_price_array(args, 7, BSAmericanApprox_batch_checked);
+}
+
+void WINAPI xlAutoFree12(LPXLOPER12 x)
+{
+	if(x->xltype & xlbitDLLFree)
+		free(x);
+}
+
+/* Counted wide string for Excel, kept in buf */
+static LPXLOPER12 xl_text(LPXLOPER12 x, XCHAR *buf, const char *s)
+{
+	size_t k, n = strlen(s);
+
+	buf[0] = (XCHAR)n;
+	for(k = 0; k < n; k++)
+		buf[k + 1] = (XCHAR)s[k];
+	x->xltype = xltypeStr;
+	x->val.str = buf;
+	return x;
+}
+
+int WINAPI xlAutoOpen(void)
+{
+	static XCHAR text[MAX_REGISTER][256];
+	XLOPER12 dll, opers[MAX_REGISTER];
+	LPXLOPER12 argv[MAX_REGISTER];
+	size_t f;
+	int j;
+
+	if(Excel12(xlGetName, &dll, 0) != xlretSuccess)
+		return 0;
+	xl_error_value.val.err = xlerrValue;
+
+	for(f = 0; f < sizeof functions / sizeof functions[0]; f++) {
+		argv[0] = &dll;
+		argv[1] = xl_text(&opers[1], text[1], functions[f].proc);
+		argv[2] = xl_text(&opers[2], text[2], functions[f].type);
+		argv[3] = xl_text(&opers[3], text[3], functions[f].name);
+		argv[4] = xl_text(&opers[4], text[4], functions[f].args);
+		argv[5] = &opers[5];
+		opers[5].xltype = xltypeNum;
+		opers[5].val.num = 1;		/* worksheet function */
+		argv[6] = xl_text(&opers[6], text[6], "fin_recipe");
+		for(j = 7; j < 9; j++) {
+			argv[j] = &opers[j];
+			opers[j].xltype = xltypeMissing;
+		}
+		argv[9] = xl_text(&opers[9], text[9], functions[f].help);
+		Excel12v(xlfRegister, NULL, MAX_REGISTER, argv);
+	}
+	Excel12(xlFree, NULL, 1, &dll);
+	return 1;
+}
+
+int WINAPI xlAutoClose(void)
+{
+	return 1;
+}
@@ -0,0 +1,13 @@
+# python setup.py build_ext --inplace
+#
+# Builds the fin_recipe extension module from fin_recipe_module.c and the
+# library source itself, so it does not need fin_recipe.dll at run time.
+
+from setuptools import setup, Extension
+
+setup(
+    name='fin_recipe',
+    version='0.1',
+    description='Option pricing kernels of fin_recipe_source.c for Python',
+    ext_modules=[Extension('fin_recipe', sources=['fin_recipe_module.c', 'fin_recipe_source.c'])],
+)